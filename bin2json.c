@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "midi_common.h"
+#include "midi_reader.h"
+#include "midi_writer.h"
+#include "midi_bin.h"
+
+// Reference reader for midi2json --format=bin. Maps the binary song and
+// writes the same json midi2json writes for the midi file, so
+//   midi2json in.mid a.json && midi2json --format=bin in.mid a.bin && bin2json a.bin b.json
+// must leave a.json and b.json byte identical.
+
+void die(const char *message);
+void write_track(midi_writer *out, const midi_bin *bin, uint32_t track);
+
+int main(int argc, char *argv[]) {
+	const char *files[2];
+	int number_of_files = 0;
+	bool shortest_floats = false;
+	for(int i = 1; i < argc; i++) {
+		if(strncmp(argv[i], "--", 2) != 0) {
+			if(number_of_files < 2) files[number_of_files] = argv[i];
+			number_of_files++;
+		} else if(strcmp(argv[i], "--shortest-floats") == 0) {
+			shortest_floats = true;
+		} else {
+			die("Unknown option.");
+		}
+	}
+	if (number_of_files < 2) die("Please provide [FILENAME_IN] and [FILENAME_OUT].");
+
+	midi_reader reader;
+	if(midi_reader_open(&reader, files[0]) < 0) die("File not found.");
+	midi_bin bin;
+	if(midi_bin_load(&bin, reader.data, reader.size) < 0) die("Not a midi2json binary file, or an unsupported version.");
+
+	int file_write_fd = open(files[1], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(file_write_fd < 0) die("Failed to create new file.");
+	midi_writer out;
+	if(midi_writer_init(&out, file_write_fd) < 0) die("Out of memory.");
+	out.shortest_floats = shortest_floats;
+
+	midi_writer_format(&out, "{\n\t\"loadmessage\": \"# loaded music.json\",\n\t\"description\": \"# music.json - converted notes generated from midi file: %.*s\",\n\t\"keys\":\"[c] command, [n] midi-note, [d] delta-time, [f] frequency, [v] velocity\",\n", (int)bin.header->name_length, bin.name);
+	midi_writer_string(&out, "\t\"info\":\"converted using midi2json by superpanic, https://github.com/superpanic\",\n");
+	midi_writer_string(&out, "\t\"tracks\":[\n");
+	for(uint32_t track = 0; track < bin.header->number_of_tracks; track++) {
+		if(track > 0) midi_writer_string(&out, ",\n");
+		write_track(&out, &bin, track);
+	}
+	midi_writer_string(&out, "\n\t]\n}");
+
+	if(midi_writer_flush(&out) < 0) die("Failed to write output.");
+	midi_writer_free(&out);
+	close(file_write_fd);
+	midi_reader_close(&reader);
+	return 0;
+}
+
+void write_track(midi_writer *out, const midi_bin *bin, uint32_t track) {
+	const midi_bin_track *t = midi_bin_get_track(bin, track);
+	midi_writer_string(out, "\t\t{\n\t\t\t\"track number\":");
+	midi_writer_uint(out, track+1);
+	midi_writer_string(out, ",\n\t\t\t\"notes\":[\n");
+	for(uint32_t i = 0; i < t->number_of_records; i++) {
+		const midi_bin_record *r = midi_bin_get_record(bin, t->first_record + i);
+		if(r->command >= 7) die("Record with unknown command.");
+		if(i > 0) midi_writer_string(out, ",\n");
+		midi_writer_string(out, "\t\t\t\t{\"c\":\"");
+		midi_writer_string(out, MIDI_EVENT_NAME_ARR[r->command]);
+		midi_writer_string(out, "\", \"n\":");
+		midi_writer_uint(out, r->data1);
+		midi_writer_string(out, ", \"d\":");
+		midi_writer_uint(out, r->delta);
+		midi_writer_string(out, ", \"f\":");
+		midi_writer_float(out, r->frequency);
+		midi_writer_string(out, ", \"v\":");
+		midi_writer_uint(out, r->data2);
+		midi_writer_char(out, '}');
+	}
+	midi_writer_string(out, "\n\t\t\t]\n\t\t}");
+}
+
+void die(const char *message) {
+	if (errno) {
+		perror(message);
+	} else {
+		printf("PROGRAM END: %s\n", message);
+	}
+	exit(errno ? errno : 1);
+}
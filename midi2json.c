@@ -4,385 +4,1644 @@
 #include <string.h>
 #include <stdbool.h>
 #include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+#include "midi_common.h"
+#include "midi_reader.h"
+#include "midi_parser.h"
+#include "midi_parallel.h"
+#include "midi_song.h"
+#include "midi_writer.h"
+#include "midi_bin.h"
+#include "midi_tempo.h"
+#include "midi_index.h"
+#include "midi_notes.h"
+#include "midi_merge.h"
+#include "midi_pixel.h"
+#include "midi_rf.h"
+#include "midi_journal.h"
+#include "midi_cache.h"
+#include "midi_fragment.h"
+#include "midi_serve.h"
 
 #define DEBUG 0
 
-#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
-#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+// when ndjson records are pushed out to the file
+typedef enum {
+	FLUSH_BUFFER,            // whenever the output buffer is full
+	FLUSH_TRACK,             // after every track
+	FLUSH_EVENT              // after every record
+} flush_policy;
+
+// how the events of a track are laid out in the json
+typedef enum {
+	LAYOUT_ROWS,             // one object per event
+	LAYOUT_COLUMNS,          // one array per field, commands as codes
+	LAYOUT_NOTES             // one object per note, Note ON and Note OFF paired
+} json_layout;
+
+// json writer state, shared by the song writer and the streaming parser callback
+typedef struct {
+	midi_writer *out;
+	FILE *log;
+	const char *filename_in;
+	int tracks_written;
+	bool is_first_midi_event;
+	flush_policy flush;      // ndjson only
+	json_layout layout;
+	midi_notes_order note_order; // LAYOUT_NOTES only
+	bool absolute_time;      // times in ms too, write_song builds the tempo maps
+	midi_tempo_map *tempo;   // the tempo map the ms are read from
+	int max_threads;         // write_song writes the tracks on up to this many, 0 one per cpu
+	size_t tempo_cursor;     // into tempo, for the track being written
+	unsigned short format;   // of the file, while streaming
+	bool tempo_fixed;        // the map is complete before the events go by, with --range
+	bool merged;             // one "events" array for all tracks
+	unsigned int last_tick;  // of the last record, with --merge
+	unsigned int range_start;
+	unsigned int range_end;
+	midi_event_callback range_inner; // gets the events of the range
+} json_output;
+
+// one track written into memory on its own, stitched together in track order
+typedef struct {
+	json_output output;
+	midi_writer out;
+	char *log_data;
+	size_t log_size;
+	bool fragment_failed;    // --incremental, the fragment could not be stored
+} track_output;
+
+// --incremental, what is kept from the fragments of the last run
+typedef struct {
+	midi_fragments *store;
+	const json_output *json;
+	unsigned long long *keys; // of every track
+	char **reused;           // fragment of every track that did not change, NULL for the others
+	size_t *reused_size;
+	int number_of_reused;
+} fragment_run;
+
+typedef struct {
+	const midi_song *song;
+	track_output *tracks;
+	fragment_run *fragments; // NULL without --incremental
+} song_output;
+
+// paired notes of one track, placed in start order as they come out of the pairing
+typedef struct {
+	json_output *output;
+	midi_note *notes;
+} note_output;
+
+// what an --emit output is written as
+typedef enum {
+	SINK_JSON,
+	SINK_BIN,
+	SINK_PIXEL,              // midi2json_pixel patterns, default grid
+	SINK_RF                  // midi2json_rf steps, default grid
+} sink_kind;
+
+// one --emit output, every sink is written from the same decoded song on its own thread
+typedef struct {
+	sink_kind kind;
+	const char *filename_out;
+	const char *error;       // set when the sink failed
+} sink;
 
-typedef unsigned char  t_1byte;
-typedef unsigned short t_2byte;
-typedef unsigned int   t_4byte;
-typedef unsigned long  t_8byte;
+typedef struct {
+	const midi_song *song;
+	const char *filename_in;
+	const json_output *json; // settings of the json sinks
+	bool shortest_floats;
+	sink *sinks;
+} sink_run;
+
+// one input of --batch
+typedef struct {
+	char *filename_in;
+	char *filename_out;
+	off_t size;
+	long long mtime;         // nanoseconds
+	bool done;               // converted by an earlier run, from the journal
+	const char *error;       // set when the file was skipped
+} batch_file;
+
+typedef struct {
+	batch_file *files;
+	size_t number_of_files;
+	size_t capacity;
+	const char *out_dir;
+	const char *extension;   // of the outputs, ".json" or ".bin"
+	bool binary;
+	bool shortest_floats;
+	json_output json;        // settings of the json outputs
+	midi_journal *journal;   // --journal, NULL without
+	midi_cache *cache;       // --cache, NULL without
+} batch;
+
+// --cache, the input name swapped in the start of an output
+typedef struct {
+	bool binary;
+	const char *from;        // the name in the output
+	const char *to;          // the name it gets
+} cache_name;
+
+// one worker of --serve, its buffers stay allocated from request to request
+typedef struct {
+	int listen_fd;
+	midi_serve_request request;
+	midi_writer out;
+} serve_worker;
+
+const int MS_DECIMALS = 3;
+const int MAX_SINKS = 8;
+const char SINK_NAME_ARR[4][6] = { "json", "bin", "pixel", "rf" };
+const json_layout SERVE_LAYOUT_ARR[3] = { LAYOUT_ROWS, LAYOUT_COLUMNS, LAYOUT_NOTES };
+const int SERVE_KEEP_SIZE = 64 * 1024 * 1024; // buffers grown beyond this are not kept for the next request
+const char JSON_HEAD[] = "{\n\t\"loadmessage\": \"# loaded music.json\",\n\t\"description\": \"# music.json - converted notes generated from midi file: ";
 
 void die(const char *message);
+void convert_song(const char *filename_in, json_output *output);
+void write_song(const midi_song *song, json_output *output, fragment_run *fragments);
+void convert_incremental(const char *filename_in, json_output *output, midi_fragments *store);
+void select_fragments(void *user, const midi_song *song, bool *decode);
+unsigned long long fragment_key(const json_output *json, const midi_song *song, int track);
+void convert_sinks(const char *filename_in, sink_run *run, int number_of_sinks);
+void write_sink(void *ctx, int index);
+void add_sink(sink *sinks, int *number_of_sinks, const char *spec);
+void convert_batch(batch *b);
+void convert_batch_file(void *ctx, int index);
+const char *write_batch_file(batch *b, batch_file *f, const unsigned char *data, size_t size);
+void add_batch_input(batch *b, const char *input);
+void add_batch_dir(batch *b, const char *dir, size_t root_len);
+void add_batch_file(batch *b, const char *filename_in, const char *name);
+void unique_batch_outputs(batch *b);
+size_t *find_batch_output(size_t *table, size_t table_size, const batch *b, const char *filename_out);
+bool is_midi_name(const char *name);
+int compare_batch_size(const void *a, const void *b);
+int make_parent_dirs(const char *path);
+unsigned long long cache_key(const unsigned char *data, size_t size, bool binary, json_layout layout, midi_notes_order note_order, bool absolute_time, bool shortest_floats);
+long replace_cache_name(void *user, const unsigned char *start, size_t size, midi_writer *out);
+void close_cache(midi_cache *cache);
+unsigned long long parse_size(const char *text);
+void serve(const char *socket_path);
+void serve_connections(void *ctx, int index);
+int serve_request(serve_worker *w, int fd);
+const char *check_song(const midi_song *song);
+void convert_stream(const char *filename_in, json_output *output, midi_event_callback callback);
+void convert_bin(const char *filename_in, midi_writer *out);
+void convert_merged(const char *filename_in, json_output *output, bool ndjson);
+void write_merged_event(json_output *o, const midi_event *ev);
+void convert_range(const char *filename_in, json_output *output, midi_event_callback callback, const char *index_file, unsigned int interval);
+void build_range_tempo(json_output *o, const unsigned char *data, const midi_index *index, int track);
+void write_index_file(const char *filename_in, const char *index_file, unsigned int interval);
+void write_song_track(void *ctx, int track);
+int write_range_event(void *user, const midi_event *ev);
+int collect_tempo(void *user, const midi_event *ev);
+int write_parsed_event(void *user, const midi_event *ev);
+int write_ndjson_event(void *user, const midi_event *ev);
+void log_header(FILE *log, unsigned int header_size, unsigned short format, unsigned short number_of_tracks, unsigned short division);
+void log_track_begin(FILE *log, int track, size_t length);
+void write_header(json_output *o, unsigned int header_size, unsigned short format, unsigned short number_of_tracks, unsigned short division);
+void write_track_begin(json_output *o, int track, size_t length);
+void write_track_end(json_output *o);
+void write_track_columns(json_output *o, const midi_song *song, const midi_song_track *t);
+void write_track_notes(json_output *o, const midi_song *song, const midi_song_track *t);
+void place_note(void *user, const midi_note *note);
+void write_meta_event(json_output *o, int type, const t_1byte *payload, size_t payload_len);
+void write_sysex_event(json_output *o);
+void write_channel_event(json_output *o, t_1byte status, t_1byte data1, t_1byte data2, unsigned int delta, unsigned int tick);
+void follow_tempo(json_output *o, const midi_event *ev);
+void build_note_fragments();
 void print_type_lengths();
-void generate_frequencies(float *m, int len);
-
-unsigned int reverse_endian_int(unsigned int x);
-unsigned short reverse_endian_short(unsigned short x);
-unsigned int ticks_per_second(unsigned int ticks_per_beat, unsigned int beats_per_minute);
-unsigned char get_low_bits(unsigned char c);
-unsigned char get_high_bits(unsigned char c);
-
-const int META_EVENT      = 0xFF;
-const int SYSEX_EVENT     = 0xF0;
-const int SYSEX_EVENT_END = 0xF7;
-const int END_OF_TRACK    = 0x2F;
-const int NOTE_ON         = 0x9;
-
-float MIDI[127];
-
-const char *FILE_HEADER = "MThd";
-const char *TRACK_HEADER = "MTrk";
-
-const int DELTA_TIME_MAX_BYTES = 4;
-
-const int MIDI_EVENT_COMMAND_ARR[7] = {
-	0x8, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE
-};
-
-const char MIDI_EVENT_NAME_ARR[7][19] = {
-	"Note OFF",
-	"Note ON",
-	"Note Aftertouch",
-	"Controller",
-	"Program Change",
-	"Channel Aftertouch",
-	"Pitch Bend"
-};
-
-const char MIDI_EVENT_LENGTH_ARR[7] = {
-	2, 2, 2, 2, 1, 1, 2
-};
-
-const int META_EVENT_TYPE_ARR[15] = {
-	0x00, 0x01, 0x02, 0x03, 0x04, 
-	0x05, 0x06, 0x07, 0x20, 0x2F, 
-	0x51, 0x54, 0x58, 0x59, 0x7F
-};
-
-const int META_EVENT_LENGTH_ARR[15] = {
-	 2, -1, -1, -1, -1,
-	-1, -1, -1,  1,  0,
-	 3,  5,  4,  2, -2
-}; // -1 == string, -2 == variable length
-
-const char META_EVENT_NAME_ARR[15][20] = {
-	"Sequence Number",
-	"Text Event",
-	"Copyright Notice",
-	"Sequence/Track Name",
-	"Instrument Name",
-
-	"Lyrics",
-	"Marker",
-	"Cue Point",
-	"Midi Channel Prefix",
-	"End of Track",
-
-	"Set tempo",
-	"SMPTE Offset",
-	"Time Signature",
-	"Key Signature",
-	"Sequencer Specific"
-};
+
+const int STREAM_READ_SIZE = 64 * 1024;
+
+// pre-rendered pieces of a note record, only the delta and velocity digits
+// are formatted per event
+typedef struct {
+	char text[56];
+	size_t len;
+} json_fragment;
+
+json_fragment NOTE_PREFIX_ARR[7][128];  // \t\t\t\t{"c":"Note ON", "n":60, "d":
+json_fragment NOTE_FREQUENCY_ARR[2][128]; // , "f":261.625610, "v": and with --shortest-floats
 
 
 int main(int argc, char *argv[]) {
 	if (DEBUG) print_type_lengths();
-	if (argc < 3) die("Please provide [FILENAME_IN] and [FILENAME_OUT].");
-	
-	char filename_in[64];
-	strncpy(filename_in, argv[1], 64);
-	filename_in[64-1] = '\0';
 
-	char filename_out[64];
-	strncpy(filename_out, argv[2], 64);
-	filename_out[64-1] = '\0';
+	// options start with "--", everything else is a file name
+	const char **files = calloc(argc, sizeof(*files));
+	if(files == NULL) die("Out of memory.");
+	int number_of_files = 0;
+	bool shortest_floats = false;
+	bool binary = false;
+	bool ndjson = false;
+	flush_policy flush = FLUSH_BUFFER;
+	json_layout layout = LAYOUT_ROWS;
+	midi_notes_order note_order = MIDI_NOTES_FIFO;
+	bool absolute_time = false;
+	const char *index_file = NULL;
+	const char *write_index = NULL;
+	unsigned int index_interval = 0;
+	const char *range = NULL;
+	bool merge = false;
+	sink sinks[MAX_SINKS];
+	int number_of_sinks = 0;
+	const char *batch_dir = NULL;
+	const char *journal_file = NULL;
+	const char *cache_dir = NULL;
+	const char *incremental_dir = NULL;
+	const char *serve_path = NULL;
+	unsigned long long cache_size = 1ULL << 30;
+	for(int i = 1; i < argc; i++) {
+		if(strncmp(argv[i], "--", 2) != 0) {
+			files[number_of_files++] = argv[i];
+		} else if(strcmp(argv[i], "--shortest-floats") == 0) {
+			shortest_floats = true;
+		} else if(strcmp(argv[i], "--format=json") == 0) {
+			binary = false;
+		} else if(strcmp(argv[i], "--format=bin") == 0) {
+			binary = true;
+		} else if(strcmp(argv[i], "--layout=rows") == 0) {
+			layout = LAYOUT_ROWS;
+		} else if(strcmp(argv[i], "--layout=columnar") == 0) {
+			layout = LAYOUT_COLUMNS;
+		} else if(strcmp(argv[i], "--notes") == 0 || strcmp(argv[i], "--notes=fifo") == 0) {
+			layout = LAYOUT_NOTES;
+			note_order = MIDI_NOTES_FIFO;
+		} else if(strcmp(argv[i], "--notes=lifo") == 0) {
+			layout = LAYOUT_NOTES;
+			note_order = MIDI_NOTES_LIFO;
+		} else if(strcmp(argv[i], "--absolute-time") == 0) {
+			absolute_time = true;
+		} else if(strncmp(argv[i], "--index=", 8) == 0) {
+			index_file = argv[i] + 8;
+		} else if(strncmp(argv[i], "--write-index=", 14) == 0) {
+			write_index = argv[i] + 14;
+		} else if(strncmp(argv[i], "--index-interval=", 17) == 0) {
+			index_interval = strtoul(argv[i] + 17, NULL, 10);
+		} else if(strncmp(argv[i], "--range=", 8) == 0) {
+			range = argv[i] + 8;
+		} else if(strcmp(argv[i], "--range") == 0 && i + 1 < argc) {
+			range = argv[++i];
+		} else if(strncmp(argv[i], "--emit=", 7) == 0) {
+			add_sink(sinks, &number_of_sinks, argv[i] + 7);
+		} else if(strcmp(argv[i], "--emit") == 0 && i + 1 < argc) {
+			add_sink(sinks, &number_of_sinks, argv[++i]);
+		} else if(strncmp(argv[i], "--batch=", 8) == 0) {
+			batch_dir = argv[i] + 8;
+		} else if(strncmp(argv[i], "--cache=", 8) == 0) {
+			cache_dir = argv[i] + 8;
+		} else if(strncmp(argv[i], "--cache-size=", 13) == 0) {
+			cache_size = parse_size(argv[i] + 13);
+		} else if(strncmp(argv[i], "--serve=", 8) == 0) {
+			serve_path = argv[i] + 8;
+		} else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+			serve_path = argv[++i];
+		} else if(strncmp(argv[i], "--incremental=", 14) == 0) {
+			incremental_dir = argv[i] + 14;
+		} else if(strncmp(argv[i], "--journal=", 10) == 0) {
+			journal_file = argv[i] + 10;
+		} else if(strcmp(argv[i], "--merge") == 0) {
+			merge = true;
+		} else if(strcmp(argv[i], "--ndjson") == 0) {
+			ndjson = true;
+		} else if(strcmp(argv[i], "--flush=buffer") == 0) {
+			flush = FLUSH_BUFFER;
+		} else if(strcmp(argv[i], "--flush=track") == 0) {
+			flush = FLUSH_TRACK;
+		} else if(strcmp(argv[i], "--flush=event") == 0) {
+			flush = FLUSH_EVENT;
+		} else {
+			die("Unknown option.");
+		}
+	}
+	if(serve_path != NULL) {
+		// the options come with every request, from midi2json_client
+		if(number_of_files > 0) die("Please provide only --serve SOCKET, the clients send the files.");
+		serve(serve_path);
+	}
+	if(journal_file != NULL && batch_dir == NULL) die("Journal works with --batch.");
+	if(incremental_dir != NULL && (binary || ndjson || range != NULL || merge || write_index != NULL || number_of_sinks > 0 || batch_dir != NULL)) die("Incremental works with the json layouts, without bin, ndjson, range, merge, index, emit or batch.");
+	if(cache_dir != NULL && (ndjson || range != NULL || merge || write_index != NULL || number_of_sinks > 0)) die("Cache works with the json layouts and bin, without ndjson, range, merge, index or emit.");
+	midi_cache cache;
+	if(cache_dir != NULL && midi_cache_open(&cache, cache_dir, cache_size) < 0) die(cache.error);
+	if(batch_dir != NULL) {
+		// every input is a midi-file, a directory, a glob pattern or @ a list of files
+		if(number_of_files < 1) die("Please provide --batch=DIR_OUT and the inputs: files, directories, glob patterns or @LIST.");
+		if(ndjson || range != NULL || merge || write_index != NULL || number_of_sinks > 0) die("Batch works with the json layouts and bin, without ndjson, range, merge, index or emit.");
+		if(layout == LAYOUT_NOTES && (binary || absolute_time)) die("Notes work with the json output, without absolute times.");
+		build_note_fragments();
+		batch b = { .out_dir = batch_dir, .extension = binary ? ".bin" : ".json", .binary = binary, .shortest_floats = shortest_floats };
+		// the files are converted in parallel, the tracks of each one in turn
+		b.json = (json_output){ .layout = layout, .note_order = note_order, .absolute_time = absolute_time, .max_threads = 1 };
+		for(int i = 0; i < number_of_files; i++) add_batch_input(&b, files[i]);
+		midi_journal journal;
+		if(journal_file != NULL) {
+			// files converted by an earlier run are skipped, failed and unfinished ones tried again
+			if(midi_journal_open(&journal, journal_file) < 0) die(journal.error);
+			b.journal = &journal;
+		}
+		if(cache_dir != NULL) b.cache = &cache;
+		convert_batch(&b);
+		if(journal_file != NULL && midi_journal_close(&journal) < 0) die(journal.error);
+		if(cache_dir != NULL) close_cache(&cache);
+		die("End of program.");
+	}
+	if(number_of_sinks > 0) {
+		// decode once, write every --emit output from the same song
+		if(number_of_files != 1) die("Please provide [FILENAME_IN] and the outputs as --emit KIND=FILE.");
+		if(binary || ndjson || range != NULL || merge || write_index != NULL) die("Emit works with the json layouts, without ndjson, range, merge or index.");
+		if(layout == LAYOUT_NOTES && absolute_time) die("Notes work with the json output, without absolute times.");
+		build_note_fragments();
+		json_output json = { .log = stdout, .layout = layout, .note_order = note_order, .absolute_time = absolute_time };
+		sink_run run = { .filename_in = files[0], .json = &json, .shortest_floats = shortest_floats, .sinks = sinks };
+		convert_sinks(files[0], &run, number_of_sinks);
+		die("End of program.");
+	}
+	if (number_of_files < 2) die("Please provide [FILENAME_IN] and [FILENAME_OUT].");
 
-	generate_frequencies(MIDI, 128);
+	unsigned int range_start = 0, range_end = 0;
+	if(range != NULL) {
+		char *end;
+		range_start = strtoul(range, &end, 10);
+		if(*end != ':') die("Range must be given as START:END in ticks.");
+		range_end = strtoul(end + 1, &end, 10);
+		if(*end != '\0' || range_end <= range_start) die("Range must be given as START:END in ticks.");
+		if(binary || layout != LAYOUT_ROWS) die("Range works with the rows and ndjson output.");
+	}
+	if(merge && (binary || layout != LAYOUT_ROWS || range != NULL)) die("Merge works with the rows and ndjson output.");
+	if(layout == LAYOUT_NOTES && (binary || ndjson || absolute_time)) die("Notes work with the json output, without absolute times.");
 
-	FILE *file_ptr;
-	printf("Opening file %s\n", filename_in);
+	const char *filename_in = files[0];
+	const char *filename_out = files[1];
+
+	int stdout_fd = -1;
+	if(strcmp(filename_out, "-") == 0) {
+		// output to stdout, the log moves over to stderr
+		stdout_fd = dup(STDOUT_FILENO);
+		if(stdout_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) die("Failed to create new file.");
+	}
 
-	file_ptr = fopen(filename_in, "rb");
-	if(file_ptr == NULL) die("File not found.");
+	build_note_fragments();
+
+	printf("Opening file %s\n", filename_in);
+	bool is_stream = midi_reader_is_stream(filename_in);
+	if(!is_stream && access(filename_in, R_OK) < 0) die("File not found.");
+	if(is_stream && (range != NULL || write_index != NULL)) die("Index and range need a midi file, not a stream.");
+	if(is_stream && merge) die("Merge needs a midi file, not a stream.");
+	if(is_stream && incremental_dir != NULL) die("Incremental needs a midi file, not a stream.");
 	printf("File \"%s\" open for reading.\n", filename_in);
 
-	FILE *file_write_ptr;
-	file_write_ptr = fopen(filename_out, "w");
-	if(file_write_ptr == NULL) die("Failed to create new file.");
-	printf("Created file \"%s\" for output.\n", filename_out);
-		
-	// read file header MThd
-	int read_len = 4;
-	t_1byte file_header[read_len];
-	fread(file_header, sizeof(file_header[0]), read_len, file_ptr);
-	bool is_a_midi_file = true;
-	for(int i=0; i<read_len; i++) {
-		printf("%c", file_header[i]);
-		if(FILE_HEADER[i] != file_header[i]) {
-			is_a_midi_file = false;
+	// a cached output of the same input and options is used, with this input's name
+	unsigned long long key = 0;
+	if(cache_dir != NULL) {
+		if(is_stream || stdout_fd >= 0) die("Cache works with a midi file converted to a file.");
+		midi_reader in;
+		if(midi_reader_open(&in, filename_in) < 0) die("File not found.");
+		key = cache_key(in.data, in.size, binary, layout, note_order, absolute_time, shortest_floats);
+		midi_reader_close(&in);
+		cache_name name = { binary, "", filename_in };
+		if(midi_cache_fetch(&cache, key, filename_out, replace_cache_name, &name)) {
+			printf("Cache hit, \"%s\" taken from the cache.\n", filename_out);
+			close_cache(&cache);
+			die("End of program.");
 		}
 	}
-	printf("\n");
-	if (!is_a_midi_file) die("Not a midi-file.");
-	printf("Midi file header signature ok.\n");
-
-	// read the file header size (big endian)
-	printf("Header info:\n");
-
-	t_4byte file_header_size;
-	fread(&file_header_size, sizeof(t_4byte), 1, file_ptr);
-	file_header_size = reverse_endian_int(file_header_size);
-	printf("\tFile header size: %u\n", file_header_size);
-
-	t_2byte file_format;
-	fread(&file_format, sizeof(file_format), 1, file_ptr);
-	file_format = reverse_endian_short(file_format);
-	if(file_format == 0) {
-		printf("\tFile format: 0 (single track)\n");
-	} else if(file_format == 1) {
-		printf("\tFile format: 1 (multiple tracks)\n");
-	} else if(file_format == 2) {
-		printf("\tFile format: 2 (independent tracks)\n");
+
+	int file_write_fd = stdout_fd >= 0 ? stdout_fd : open(filename_out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(file_write_fd < 0) die("Failed to create new file.");
+	printf("Created file \"%s\" for output.\n", filename_out);
+
+	midi_writer out;
+	if(midi_writer_init(&out, file_write_fd) < 0) die("Out of memory.");
+	out.shortest_floats = shortest_floats;
+	json_output output = { .out = &out, .log = stdout, .filename_in = filename_in, .flush = flush, .layout = layout, .note_order = note_order, .merged = merge, .absolute_time = absolute_time };
+	midi_tempo_map tempo;
+	midi_tempo_map_init(&tempo, 0);
+	if(absolute_time) output.tempo = &tempo;
+	if(range != NULL) {
+		// only the events in the range, decoding starts at the index checkpoints
+		output.range_start = range_start;
+		output.range_end = range_end;
+		convert_range(filename_in, &output, ndjson ? write_ndjson_event : write_parsed_event, index_file, index_interval);
+		if(!ndjson) midi_writer_string(&out, "\n\t]\n}");
+	} else if(merge) {
+		// all tracks in one timeline
+		convert_merged(filename_in, &output, ndjson);
+		if(!ndjson) midi_writer_string(&out, "\n\t]\n}");
+	} else if(binary) {
+		convert_bin(filename_in, &out);
+	} else if(ndjson) {
+		// one record per line in file order, read in slices so memory stays constant
+		convert_stream(filename_in, &output, write_ndjson_event);
+	} else if(is_stream && layout == LAYOUT_ROWS) {
+		// pipes and stdin are parsed while they arrive
+		convert_stream(filename_in, &output, write_parsed_event);
+		midi_writer_string(&out, "\n\t]\n}");
+	} else if(incremental_dir != NULL) {
+		// tracks that did not change since the last run come from their fragments
+		midi_fragments fragments;
+		if(midi_fragments_open(&fragments, incremental_dir, filename_out) < 0) die(fragments.error);
+		convert_incremental(filename_in, &output, &fragments);
+		midi_writer_string(&out, "\n\t]\n}");
 	} else {
-		die("Ending program, unknown Midi-file format: %u");
+		convert_song(filename_in, &output);
+		midi_writer_string(&out, "\n\t]\n}");
+	}
+
+	if(midi_writer_flush(&out) < 0) die("Failed to write output.");
+	midi_writer_free(&out);
+	midi_tempo_map_free(&tempo);
+	close(file_write_fd);
+	if(write_index != NULL) write_index_file(filename_in, write_index, index_interval);
+	if(cache_dir != NULL) {
+		cache_name name = { binary, filename_in, "" };
+		if(midi_cache_store(&cache, key, filename_out, replace_cache_name, &name) < 0) printf("Could not store the output in the cache: %s\n", cache.error);
+		close_cache(&cache);
+	}
+	die("End of program.");
+	return 0;
+}
+
+void convert_stream(const char *filename_in, json_output *output, midi_event_callback callback) {
+	int fd = strcmp(filename_in, "-") == 0 ? STDIN_FILENO : open(filename_in, O_RDONLY);
+	if(fd < 0) die("File not found.");
+
+	midi_parser parser;
+	midi_parser_init(&parser, callback, output);
+	t_1byte buffer[STREAM_READ_SIZE];
+	for(;;) {
+		ssize_t n = read(fd, buffer, sizeof(buffer));
+		if(n < 0 && errno == EINTR) continue;
+		if(n < 0) die("Failed to read input.");
+		if(n == 0) break;
+		if(midi_parser_feed(&parser, buffer, n) < 0) break;
 	}
+	if(parser.error_code == MIDI_OK) midi_parser_finish(&parser);
+	// the callbacks only stop the parse when the output failed
+	if(parser.error_code == MIDI_ERROR_STOPPED) die("Failed to write output.");
+	if(parser.error_code != MIDI_OK) die(parser.error);
+	midi_parser_free(&parser);
+	if(fd != STDIN_FILENO) close(fd);
+
+	if(output->tracks_written < parser.event.number_of_tracks) die("Could not find midi-track.");
+}
 
-	t_2byte number_of_tracks;
-	fread(&number_of_tracks, sizeof(number_of_tracks), 1, file_ptr);
-	number_of_tracks = reverse_endian_short(number_of_tracks);
-	printf("\tNumber of tracks: %u\n", number_of_tracks);
+void convert_song(const char *filename_in, json_output *output) {
+	// decode the whole file into the shared song store, tracks in parallel
+	midi_song song;
+	midi_song_init(&song);
+	if(midi_song_load_file(&song, filename_in) < 0) die(song.error);
+	write_song(&song, output, NULL);
+	midi_song_free(&song);
+}
 
-	t_2byte delta_time_ticks;
-	fread(&delta_time_ticks, sizeof(delta_time_ticks), 1, file_ptr);
-	delta_time_ticks = reverse_endian_short(delta_time_ticks);
-	printf("\tDelta time ticks: %u\n", delta_time_ticks);
+void write_song(const midi_song *song, json_output *output, fragment_run *fragments) {
+	write_header(output, song->header_size, song->format, song->number_of_tracks, song->division);
 
-	printf("\tTicks per second: %u\n", ticks_per_second(delta_time_ticks, 60));
-	
-	fprintf(file_write_ptr, "{\n\t\"loadmessage\": \"# loaded music.json\",\n\t\"description\": \"# music.json - converted notes generated from midi file: %s\",\n\t\"keys\":\"[c] command, [n] midi-note, [d] delta-time, [f] frequency, [v] velocity\",\n", filename_in);
-	fprintf(file_write_ptr, "\t\"info\":\"converted using midi2json by superpanic, https://github.com/superpanic\",\n");
-	fprintf(file_write_ptr, "\t\"tracks\":[\n");
+	int number_of_tracks = song->number_of_tracks;
+	track_output *tracks = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(track_output));
+	if(tracks == NULL) die("Out of memory.");
 
-	// read midi tracks
+	// format 2 tracks are independent songs with their own tempo, the others follow track 0
+	int number_of_maps = !output->absolute_time ? 0 : song->format == 2 ? number_of_tracks : 1;
+	midi_tempo_map *tempo_maps = calloc(number_of_maps > 0 ? number_of_maps : 1, sizeof(midi_tempo_map));
+	if(tempo_maps == NULL) die("Out of memory.");
+	for(int map = 0; map < number_of_maps; map++) {
+		if(midi_tempo_map_build(&tempo_maps[map], song, map) < 0) die("Out of memory.");
+	}
 	for(int track = 0; track < number_of_tracks; track++) {
-		printf("Track %u:\n", track+1);
-
-		read_len = 4;
-		t_1byte track_header[read_len + 1];
-		fread(track_header, sizeof(track_header[0]), read_len, file_ptr);
-		bool is_a_midi_track = true;
-		for(int i=0; i<read_len; i++) {
-			//printf("%c", track_header[i]);
-			if(TRACK_HEADER[i] != track_header[i]) {
-				is_a_midi_track = false;
-			}
+		// each track collects in memory, the writer of the file gets them in order
+		if(midi_writer_init(&tracks[track].out, -1) < 0) die("Out of memory.");
+		tracks[track].out.shortest_floats = output->out->shortest_floats;
+		tracks[track].output.out = &tracks[track].out;
+		tracks[track].output.layout = output->layout;
+		tracks[track].output.note_order = output->note_order;
+		if(number_of_maps > 0) tracks[track].output.tempo = &tempo_maps[number_of_maps > 1 ? track : 0];
+		tracks[track].output.log = open_memstream(&tracks[track].log_data, &tracks[track].log_size);
+		if(tracks[track].output.log == NULL) die("Out of memory.");
+	}
+	song_output ctx = { .song = song, .tracks = tracks, .fragments = fragments };
+	midi_parallel_for(number_of_tracks, output->max_threads, write_song_track, &ctx);
+
+	// stitch the tracks back together in track order
+	for(int track = 0; track < number_of_tracks; track++) {
+		fclose(tracks[track].output.log);
+		fwrite(tracks[track].log_data, 1, tracks[track].log_size, output->log);
+		if(output->tracks_written++ > 0) midi_writer_string(output->out, ",\n");
+		if(fragments != NULL && fragments->reused[track] != NULL) {
+			log_track_begin(output->log, track, song->tracks[track].length);
+			fprintf(output->log, "\tUnchanged, taken from the fragments.\n");
+			midi_writer_bytes(output->out, fragments->reused[track], fragments->reused_size[track]);
+		} else {
+			midi_writer_append(output->out, &tracks[track].out);
 		}
-		track_header[read_len] = '\0';
-		
-		if (!is_a_midi_track) die("Could not find midi-track.");
-		printf("\tMidi track header signature: %s\n",track_header);
-
-		t_4byte number_of_events;
-		fread(&number_of_events, sizeof(number_of_events), 1, file_ptr);
-		number_of_events = reverse_endian_int(number_of_events);
-		printf("\tTrack length: %u\n", number_of_events);
-
-		bool is_first_midi_event = true;
-		fprintf(file_write_ptr, "\t\t{");
-		fprintf(file_write_ptr, "\n\t\t\t\"track number\":%u,", track+1);
-		fprintf(file_write_ptr, "\n\t\t\t\"notes\":[\n");
-		
-		// event loop:
-		for(int event = 0; event < number_of_events; event++) {
-			// reading delta time	
-			t_1byte delta_time_buffer[DELTA_TIME_MAX_BYTES];
-			t_1byte delta_time_byte=0xFF;
-			int byte_counter = 0;
-			while(delta_time_byte>=0x80) {
-				if( fread(&delta_time_byte, sizeof(delta_time_byte), 1, file_ptr) == EOF ) die("Reached end of file.");
-				if( byte_counter >= DELTA_TIME_MAX_BYTES ) die("Delta time byte count read exceeds limit.");
-				delta_time_buffer[byte_counter] = delta_time_byte;
-				byte_counter++;
-			}
-			
-			// calculate delta time
-			int delta_time_value = 0;
-			for(int i = 0; i<byte_counter; i++) {
-				int dt = delta_time_buffer[i] & 127; // set msb to 0
-				delta_time_value = delta_time_value << 7; // leave room for 7 bits
-				delta_time_value = delta_time_value + dt; // add new value
-			}
-			if (DEBUG) printf("Event %u at delta time: %u\n", event, delta_time_value);
-			
-			// read until command type is found
-			t_1byte command_byte = 0;
-			int jump_byte_counter = 0;
-			while( command_byte < 0x80) {
-				if(fread(&command_byte, sizeof(command_byte), 1, file_ptr) == EOF) die("Reached end of file.");
-				jump_byte_counter++;
+		if(tracks[track].fragment_failed) fprintf(output->log, "\tCould not store the fragment of track %d.\n", track+1);
+		midi_writer_free(&tracks[track].out);
+		free(tracks[track].log_data);
+	}
+	free(tracks);
+	for(int map = 0; map < number_of_maps; map++) midi_tempo_map_free(&tempo_maps[map]);
+	free(tempo_maps);
+}
+
+void convert_incremental(const char *filename_in, json_output *output, midi_fragments *store) {
+	// only the tracks whose chunk changed since the last run are decoded and written
+	midi_reader in;
+	if(midi_reader_open(&in, filename_in) < 0) die("File not found.");
+	fragment_run run = { .store = store, .json = output };
+	midi_song song;
+	midi_song_init(&song);
+	if(midi_song_load_filtered(&song, in.data, in.size, select_fragments, &run) < 0) die(song.error);
+	midi_reader_close(&in);
+	write_song(&song, output, &run);
+	fprintf(output->log, "%d of %u tracks unchanged, %d converted.\n", run.number_of_reused, song.number_of_tracks, song.number_of_tracks - run.number_of_reused);
+
+	if(midi_fragments_close(store, run.keys, song.number_of_tracks) < 0) die(store->error);
+	for(int track = 0; track < song.number_of_tracks; track++) free(run.reused[track]);
+	free(run.reused);
+	free(run.reused_size);
+	free(run.keys);
+	midi_song_free(&song);
+}
+
+void select_fragments(void *user, const midi_song *song, bool *decode) {
+	fragment_run *run = user;
+	int number_of_tracks = song->number_of_tracks;
+	run->keys = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(*run->keys));
+	run->reused = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(*run->reused));
+	run->reused_size = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(*run->reused_size));
+	if(run->keys == NULL || run->reused == NULL || run->reused_size == NULL) die("Out of memory.");
+	for(int track = 0; track < number_of_tracks; track++) {
+		run->keys[track] = fragment_key(run->json, song, track);
+		run->reused[track] = midi_fragments_read(run->store, run->keys[track], &run->reused_size[track]);
+		decode[track] = run->reused[track] == NULL;
+		if(!decode[track]) run->number_of_reused++;
+	}
+	// the times of every track come from the tempo map of track 0
+	if(run->json->absolute_time && song->format != 2) decode[0] = true;
+}
+
+// everything the json of one track depends on: its chunk, its number and the options
+unsigned long long fragment_key(const json_output *json, const midi_song *song, int track) {
+	unsigned long long tempo = json->absolute_time && song->format != 2 ? song->tracks[0].hash : 0;
+	char options[192];
+	snprintf(options, sizeof(options), "midi2json 1 layout=%d order=%d ms=%d shortest=%d format=%u division=%u tempo=%016llx track=%d",
+		json->layout, json->note_order, json->absolute_time, json->out->shortest_floats, song->format, song->division, tempo, track);
+	return midi_hash(options, strlen(options) + 1, song->tracks[track].hash);
+}
+
+void convert_range(const char *filename_in, json_output *output, midi_event_callback callback, const char *index_file, unsigned int interval) {
+	midi_reader in;
+	if(midi_reader_open(&in, filename_in) < 0) die("File not found.");
+	midi_event header = { .kind = MIDI_EVENT_HEADER };
+	const unsigned char *signature = midi_reader_bytes(&in, 4);
+	if(signature == NULL || memcmp(signature, FILE_HEADER, 4) != 0) die("Not a midi-file.");
+	if(!midi_reader_u32(&in, &header.header_size)) die("Reached end of file.");
+
+	// a sidecar index made for this file, or a scan of the whole file when there is none
+	midi_index index;
+	midi_index_init(&index);
+	bool loaded = false;
+	midi_reader sidecar;
+	if(index_file != NULL && midi_reader_open(&sidecar, index_file) == 0) {
+		loaded = midi_index_load(&index, sidecar.data, sidecar.size, in.data, in.size) == 0;
+		midi_reader_close(&sidecar);
+		// and the bytes the decoding of the range starts from
+		for(int track = 0; loaded && track < index.number_of_tracks; track++) {
+			loaded = midi_index_check(&index, in.data, track, midi_index_seek(&index, track, output->range_start)) == 0;
+		}
+	}
+	if(index_file != NULL && !loaded) printf("Index \"%s\" not usable, scanning the whole file.\n", index_file);
+	if(!loaded && midi_index_build(&index, in.data, in.size, interval) < 0) die(index.error);
+
+	header.format = index.format;
+	header.number_of_tracks = index.number_of_tracks;
+	header.division = index.division;
+	output->range_inner = callback;
+	callback(output, &header);
+	if(output->tempo != NULL && index.format != 2) build_range_tempo(output, in.data, &index, 0);
+
+	for(int track = 0; track < index.number_of_tracks; track++) {
+		if(output->tempo != NULL && index.format == 2) build_range_tempo(output, in.data, &index, track);
+		const midi_index_track *t = &index.tracks[track];
+		const midi_parser_position *start = midi_index_seek(&index, track, output->range_start);
+		midi_parser parser;
+		midi_parser_init_track_at(&parser, track, t->chunk_length, start, write_range_event, output);
+		midi_parser_feed(&parser, in.data + t->chunk_offset + start->offset, t->chunk_length - start->offset);
+		if(parser.error_code == MIDI_OK) midi_parser_finish(&parser);
+		if(output->out->failed) die("Failed to write output.");
+		if(parser.error_code == MIDI_ERROR_STOPPED) {
+			// stopped at the end of the range, the track ends there
+			midi_event track_end = { .kind = MIDI_EVENT_TRACK_END, .track = track, .tick = output->range_end };
+			callback(output, &track_end);
+		} else if(parser.error_code != MIDI_OK) {
+			die(parser.error);
+		}
+		midi_parser_free(&parser);
+	}
+	midi_index_free(&index);
+	midi_reader_close(&in);
+}
+
+// the tempo changes up to the end of the range, from the start of the track that holds them
+void build_range_tempo(json_output *o, const unsigned char *data, const midi_index *index, int track) {
+	const midi_index_track *t = &index->tracks[track];
+	midi_tempo_map_free(o->tempo);
+	midi_tempo_map_init(o->tempo, index->division);
+	midi_parser parser;
+	midi_parser_init_track(&parser, track, t->chunk_length, collect_tempo, o);
+	midi_parser_feed(&parser, data + t->chunk_offset, t->chunk_length);
+	if(parser.error_code != MIDI_OK && parser.error_code != MIDI_ERROR_STOPPED) die(parser.error);
+	midi_parser_free(&parser);
+	o->tempo_fixed = true;
+}
+
+int collect_tempo(void *user, const midi_event *ev) {
+	json_output *o = user;
+	if(ev->kind != MIDI_EVENT_CHANNEL && ev->kind != MIDI_EVENT_META && ev->kind != MIDI_EVENT_SYSEX) return 0;
+	if(ev->tick >= o->range_end) return 1;
+	if(ev->kind == MIDI_EVENT_META && ev->type == SET_TEMPO) {
+		if(midi_tempo_map_add(o->tempo, ev->tick, midi_tempo_value(ev->payload, ev->payload_len)) < 0) die("Out of memory.");
+	}
+	return 0;
+}
+
+int write_range_event(void *user, const midi_event *ev) {
+	json_output *o = user;
+	if(ev->kind == MIDI_EVENT_CHANNEL || ev->kind == MIDI_EVENT_META || ev->kind == MIDI_EVENT_SYSEX) {
+		if(ev->tick >= o->range_end) return 1;
+		if(ev->tick < o->range_start) return 0;
+	}
+	return o->range_inner(user, ev);
+}
+
+void write_index_file(const char *filename_in, const char *index_file, unsigned int interval) {
+	midi_reader in;
+	if(midi_reader_open(&in, filename_in) < 0) die("File not found.");
+	midi_index index;
+	midi_index_init(&index);
+	if(midi_index_build(&index, in.data, in.size, interval) < 0) die(index.error);
+	int fd = open(index_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(fd < 0) die("Failed to create index file.");
+	midi_writer w;
+	if(midi_writer_init(&w, fd) < 0) die("Out of memory.");
+	midi_index_write(&index, &w);
+	if(midi_writer_flush(&w) < 0) die("Failed to write index file.");
+	printf("Created index \"%s\": %zu checkpoints, one every %u ticks.\n", index_file, index.number_of_checkpoints, index.interval);
+	midi_writer_free(&w);
+	close(fd);
+	midi_index_free(&index);
+	midi_reader_close(&in);
+}
+
+void convert_merged(const char *filename_in, json_output *output, bool ndjson) {
+	midi_reader in;
+	if(midi_reader_open(&in, filename_in) < 0) die("File not found.");
+	midi_merge merge;
+	if(midi_merge_init(&merge, in.data, in.size) < 0) die(merge.error);
+
+	const midi_event *ev = &merge.header;
+	if(ndjson) {
+		write_ndjson_event(output, ev);
+	} else {
+		follow_tempo(output, ev);
+		write_header(output, ev->header_size, ev->format, ev->number_of_tracks, ev->division);
+	}
+	int result;
+	while((result = midi_merge_next(&merge, &ev)) > 0) {
+		if(ndjson) {
+			if(write_ndjson_event(output, ev) != 0) die("Failed to write output.");
+			continue;
+		}
+		follow_tempo(output, ev);
+		if(ev->kind == MIDI_EVENT_META) {
+			write_meta_event(output, ev->type, ev->payload, ev->payload_len);
+		} else if(ev->kind == MIDI_EVENT_SYSEX) {
+			write_sysex_event(output);
+		} else {
+			write_merged_event(output, ev);
+		}
+	}
+	if(result < 0) die(merge.error);
+	midi_merge_free(&merge);
+	midi_reader_close(&in);
+}
+
+// like write_channel_event with the track number in front, the delta is
+// counted from the record before, whatever track it came from
+void write_merged_event(json_output *o, const midi_event *ev) {
+	midi_writer *out = o->out;
+	if(!o->is_first_midi_event) {
+		midi_writer_string(out, ",\n");
+	} else {
+		o->is_first_midi_event = false;
+	}
+	int midi_event_number = MIDI_STATUS_TABLE[ev->status].command;
+	const json_fragment *prefix = &NOTE_PREFIX_ARR[midi_event_number][ev->data[0]];
+	const json_fragment *frequency = &NOTE_FREQUENCY_ARR[out->shortest_floats][ev->data[0]];
+	midi_writer_string(out, "\t\t{\"t\":");
+	midi_writer_uint(out, ev->track+1);
+	midi_writer_string(out, ", ");
+	// the prefix without its "\t\t\t\t{"
+	midi_writer_bytes(out, prefix->text + 5, prefix->len - 5);
+	midi_writer_uint(out, ev->tick - o->last_tick);
+	midi_writer_bytes(out, frequency->text, frequency->len);
+	midi_writer_uint(out, ev->data[1]);
+	if(o->tempo != NULL) {
+		midi_writer_string(out, ", \"ms\":");
+		midi_writer_fixed(out, midi_tempo_ms(o->tempo, &o->tempo_cursor, ev->tick), MS_DECIMALS);
+	}
+	midi_writer_char(out, '}');
+	o->last_tick = ev->tick;
+}
+
+void convert_bin(const char *filename_in, midi_writer *out) {
+	midi_song song;
+	midi_song_init(&song);
+	if(midi_song_load_file(&song, filename_in) < 0) die(song.error);
+	printf("Number of tracks: %u\n", song.number_of_tracks);
+	printf("Number of events: %zu\n", song.number_of_events);
+	if(midi_bin_write(out, &song, filename_in) < 0) die("Failed to write output.");
+	midi_song_free(&song);
+}
+
+void convert_sinks(const char *filename_in, sink_run *run, int number_of_sinks) {
+	printf("Opening file %s\n", filename_in);
+	midi_song song;
+	midi_song_init(&song);
+	if(midi_song_load_file(&song, filename_in) < 0) die(song.error);
+	printf("File \"%s\" open for reading.\n", filename_in);
+
+	// the song is not changed after loading, so every sink reads it at its own pace
+	run->song = &song;
+	midi_parallel_for(number_of_sinks, number_of_sinks, write_sink, run);
+
+	bool failed = false;
+	for(int i = 0; i < number_of_sinks; i++) {
+		const sink *k = &run->sinks[i];
+		if(k->error != NULL) {
+			printf("Failed %s output \"%s\": %s\n", SINK_NAME_ARR[k->kind], k->filename_out, k->error);
+			failed = true;
+		} else {
+			printf("Wrote %s output \"%s\".\n", SINK_NAME_ARR[k->kind], k->filename_out);
+		}
+	}
+	midi_song_free(&song);
+	if(failed) die("Failed to write output.");
+}
+
+void write_sink(void *ctx, int index) {
+	sink_run *run = ctx;
+	sink *k = &run->sinks[index];
+	int fd = open(k->filename_out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(fd < 0) {
+		k->error = "Failed to create new file.";
+		return;
+	}
+	midi_writer out;
+	if(midi_writer_init(&out, fd) < 0) {
+		k->error = "Out of memory.";
+		close(fd);
+		return;
+	}
+	if(k->kind == SINK_JSON) {
+		json_output output = *run->json;
+		out.shortest_floats = run->shortest_floats;
+		output.out = &out;
+		output.filename_in = run->filename_in;
+		write_song(run->song, &output, NULL);
+		midi_writer_string(&out, "\n\t]\n}");
+	} else if(k->kind == SINK_BIN) {
+		if(midi_bin_write(&out, run->song, run->filename_in) < 0) k->error = "Failed to write output.";
+	} else if(k->kind == SINK_PIXEL) {
+		midi_pixel_options options;
+		midi_pixel_options_init(&options);
+		midi_pixel_stats stats;
+		if(midi_pixel_write(&out, run->song, run->filename_in, &options, &stats) < 0) k->error = stats.error;
+	} else {
+		midi_rf_options options;
+		midi_rf_options_init(&options);
+		if(midi_rf_write(&out, run->song, run->filename_in, &options) < 0) k->error = "Out of memory.";
+	}
+	if(midi_writer_flush(&out) < 0 && k->error == NULL) k->error = "Failed to write output.";
+	midi_writer_free(&out);
+	close(fd);
+}
+
+// KIND=FILE, KIND one of SINK_NAME_ARR
+void add_sink(sink *sinks, int *number_of_sinks, const char *spec) {
+	if(*number_of_sinks == MAX_SINKS) die("Too many --emit outputs.");
+	const char *equals = strchr(spec, '=');
+	if(equals == NULL || equals[1] == '\0') die("Emit must be given as KIND=FILE, KIND one of json, bin, pixel, rf.");
+	for(int kind = SINK_JSON; kind <= SINK_RF; kind++) {
+		if(strlen(SINK_NAME_ARR[kind]) == (size_t)(equals - spec) && strncmp(spec, SINK_NAME_ARR[kind], equals - spec) == 0) {
+			sinks[(*number_of_sinks)++] = (sink){ .kind = kind, .filename_out = equals + 1 };
+			return;
+		}
+	}
+	die("Emit must be given as KIND=FILE, KIND one of json, bin, pixel, rf.");
+}
+
+void convert_batch(batch *b) {
+	if(mkdir(b->out_dir, 0777) < 0 && errno != EEXIST) die("Failed to create output directory.");
+	errno = 0;
+	unique_batch_outputs(b);
+	// largest files first: the workers pull the next file whenever they are
+	// done, so a few giant files at the end can't hold up the whole run
+	qsort(b->files, b->number_of_files, sizeof(batch_file), compare_batch_size);
+	// unchanged since the journal recorded them as converted, and the output is still there
+	size_t done = 0;
+	for(size_t i = 0; i < b->number_of_files && b->journal != NULL; i++) {
+		batch_file *f = &b->files[i];
+		const midi_journal_entry *entry = midi_journal_find(b->journal, f->filename_in);
+		f->done = entry != NULL && entry->status == MIDI_JOURNAL_OK && entry->size == (unsigned long long)f->size && entry->mtime == f->mtime && access(f->filename_out, F_OK) == 0;
+		if(f->done) done++;
+	}
+	printf("Converting %zu files to \"%s\".\n", b->number_of_files - done, b->out_dir);
+	if(done > 0) printf("Skipping %zu files converted by an earlier run.\n", done);
+	b->json.log = fopen("/dev/null", "w");
+	if(b->json.log == NULL) die("Failed to open /dev/null.");
+	midi_parallel_for(b->number_of_files, 0, convert_batch_file, b);
+	fclose(b->json.log);
+
+	size_t skipped = 0;
+	for(size_t i = 0; i < b->number_of_files; i++) {
+		batch_file *f = &b->files[i];
+		if(f->error != NULL) {
+			printf("Skipped \"%s\": %s\n", f->filename_in, f->error);
+			skipped++;
+		}
+		free(f->filename_in);
+		free(f->filename_out);
+	}
+	printf("Converted %zu files, skipped %zu.\n", b->number_of_files - done - skipped, skipped);
+	free(b->files);
+	// the main thread converts too, a skipped file is not an error of the run
+	errno = 0;
+}
+
+void convert_batch_file(void *ctx, int index) {
+	batch *b = ctx;
+	batch_file *f = &b->files[index];
+	if(f->done) return;
+	midi_reader in;
+	if(midi_reader_open(&in, f->filename_in) < 0) {
+		f->error = "File not found.";
+		midi_journal_entry entry = { .path = f->filename_in, .status = MIDI_JOURNAL_FAILED };
+		if(b->journal != NULL) midi_journal_add(b->journal, &entry);
+		return;
+	}
+	midi_journal_entry entry = { .path = f->filename_in, .size = in.size, .mtime = f->mtime };
+	if(b->journal != NULL) {
+		entry.hash = midi_hash(in.data, in.size, MIDI_HASH_SEED);
+		// only touched since it was converted: same content, the output stands
+		const midi_journal_entry *last = midi_journal_find(b->journal, f->filename_in);
+		if(last == NULL || last->status != MIDI_JOURNAL_OK || last->hash != entry.hash || last->size != in.size || access(f->filename_out, F_OK) < 0) {
+			f->error = write_batch_file(b, f, in.data, in.size);
+		}
+		entry.status = f->error == NULL ? MIDI_JOURNAL_OK : MIDI_JOURNAL_FAILED;
+		midi_journal_add(b->journal, &entry);
+	} else {
+		f->error = write_batch_file(b, f, in.data, in.size);
+	}
+	midi_reader_close(&in);
+}
+
+// converts one file, returns why it failed or NULL
+const char *write_batch_file(batch *b, batch_file *f, const unsigned char *data, size_t size) {
+	if(make_parent_dirs(f->filename_out) < 0) return "Failed to create new file.";
+	unsigned long long key = 0;
+	if(b->cache != NULL) {
+		key = cache_key(data, size, b->binary, b->json.layout, b->json.note_order, b->json.absolute_time, b->shortest_floats);
+		cache_name name = { b->binary, "", f->filename_in };
+		if(midi_cache_fetch(b->cache, key, f->filename_out, replace_cache_name, &name)) return NULL;
+	}
+	midi_song song;
+	midi_song_init(&song);
+	if(midi_song_load_threads(&song, data, size, b->json.max_threads) < 0) {
+		const char *error = song.error;
+		midi_song_free(&song);
+		return error;
+	}
+	// a bad file is skipped, it must not end the whole run
+	const char *error = b->binary ? NULL : check_song(&song);
+	if(error != NULL) {
+		midi_song_free(&song);
+		return error;
+	}
+	int fd = open(f->filename_out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	midi_writer out;
+	if(fd < 0) {
+		error = "Failed to create new file.";
+	} else if(midi_writer_init(&out, fd) < 0) {
+		error = "Out of memory.";
+	} else {
+		out.shortest_floats = b->shortest_floats;
+		if(b->binary) {
+			midi_bin_write(&out, &song, f->filename_in);
+		} else {
+			json_output output = b->json;
+			output.out = &out;
+			output.filename_in = f->filename_in;
+			write_song(&song, &output, NULL);
+			midi_writer_string(&out, "\n\t]\n}");
+		}
+		if(midi_writer_flush(&out) < 0) error = "Failed to write output.";
+		midi_writer_free(&out);
+	}
+	if(fd >= 0) close(fd);
+	midi_song_free(&song);
+	if(error == NULL && b->cache != NULL) {
+		cache_name name = { b->binary, f->filename_in, "" };
+		midi_cache_store(b->cache, key, f->filename_out, replace_cache_name, &name);
+	}
+	return error;
+}
+
+// a file, a directory (searched for midi-files), @ a file with one path per line, or a glob pattern
+void add_batch_input(batch *b, const char *input) {
+	struct stat st;
+	if(input[0] == '@') {
+		FILE *list = fopen(input + 1, "r");
+		if(list == NULL) die("File not found.");
+		char *line = NULL;
+		size_t line_size = 0;
+		ssize_t len;
+		while((len = getline(&line, &line_size, list)) > 0) {
+			while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+			if(len > 0) add_batch_file(b, line, NULL);
+		}
+		free(line);
+		fclose(list);
+	} else if(stat(input, &st) == 0 && S_ISDIR(st.st_mode)) {
+		size_t root_len = strlen(input);
+		while(root_len > 1 && input[root_len-1] == '/') root_len--;
+		add_batch_dir(b, input, root_len);
+	} else if(strpbrk(input, "*?[") != NULL) {
+		glob_t matches;
+		if(glob(input, 0, NULL, &matches) == 0) {
+			for(size_t i = 0; i < matches.gl_pathc; i++) add_batch_file(b, matches.gl_pathv[i], NULL);
+		}
+		globfree(&matches);
+	} else {
+		add_batch_file(b, input, NULL);
+	}
+	errno = 0;
+}
+
+// the outputs keep the directory layout below the input directory
+void add_batch_dir(batch *b, const char *dir, size_t root_len) {
+	DIR *d = opendir(dir);
+	if(d == NULL) return;
+	struct dirent *entry;
+	while((entry = readdir(d)) != NULL) {
+		if(entry->d_name[0] == '.') continue;
+		size_t len = strlen(dir) + strlen(entry->d_name) + 2;
+		char *path = malloc(len);
+		if(path == NULL) die("Out of memory.");
+		snprintf(path, len, "%s/%s", dir, entry->d_name);
+		struct stat st;
+		if(stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+			add_batch_dir(b, path, root_len);
+		} else if(is_midi_name(entry->d_name)) {
+			add_batch_file(b, path, path + root_len + 1);
+		}
+		free(path);
+	}
+	closedir(d);
+}
+
+// name is the output path below the output directory, the base name of the input when NULL
+void add_batch_file(batch *b, const char *filename_in, const char *name) {
+	if(name == NULL) {
+		const char *slash = strrchr(filename_in, '/');
+		name = slash != NULL ? slash + 1 : filename_in;
+	}
+	if(b->number_of_files == b->capacity) {
+		size_t capacity = b->capacity > 0 ? b->capacity * 2 : 256;
+		batch_file *files = realloc(b->files, capacity * sizeof(batch_file));
+		if(files == NULL) die("Out of memory.");
+		b->files = files;
+		b->capacity = capacity;
+	}
+	// the extension of the input is replaced
+	const char *dot = strrchr(name, '.');
+	size_t name_len = dot != NULL && strchr(dot, '/') == NULL ? (size_t)(dot - name) : strlen(name);
+	size_t len = strlen(b->out_dir) + name_len + strlen(b->extension) + 2;
+	batch_file *f = &b->files[b->number_of_files++];
+	struct stat st;
+	bool found = stat(filename_in, &st) == 0;
+	f->size = found ? st.st_size : 0;
+	f->mtime = found ? st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec : 0;
+	f->done = false;
+	f->error = NULL;
+	f->filename_in = strdup(filename_in);
+	f->filename_out = malloc(len);
+	if(f->filename_in == NULL || f->filename_out == NULL) die("Out of memory.");
+	snprintf(f->filename_out, len, "%s/%.*s%s", b->out_dir, (int)name_len, name, b->extension);
+}
+
+// inputs from different directories can have the same name, the later ones get
+// "-2", "-3", ... before the extension. Runs in input order, so the same
+// command names them the same way again. An input given twice is converted once
+void unique_batch_outputs(batch *b) {
+	size_t table_size = 1024;
+	while(table_size < b->number_of_files * 2) table_size *= 2;
+	size_t *table = calloc(table_size, sizeof(size_t)); // file index + 1, 0 is empty
+	if(table == NULL) die("Out of memory.");
+	size_t kept = 0;
+	for(size_t i = 0; i < b->number_of_files; i++) {
+		batch_file *f = &b->files[i];
+		size_t *slot = find_batch_output(table, table_size, b, f->filename_out);
+		if(*slot != 0 && strcmp(b->files[*slot - 1].filename_in, f->filename_in) == 0) {
+			free(f->filename_in);
+			free(f->filename_out);
+			continue;
+		}
+		b->files[kept] = *f;
+		f = &b->files[kept++];
+		if(*slot != 0) {
+			size_t ext_len = strlen(b->extension);
+			size_t base_len = strlen(f->filename_out) - ext_len;
+			size_t len = base_len + ext_len + 24;
+			char *renamed = malloc(len);
+			if(renamed == NULL) die("Out of memory.");
+			for(int n = 2; *slot != 0; n++) {
+				snprintf(renamed, len, "%.*s-%d%s", (int)base_len, f->filename_out, n, b->extension);
+				slot = find_batch_output(table, table_size, b, renamed);
 			}
-			if(jump_byte_counter > 1) printf("\tFast forward %u bytes.\n", jump_byte_counter-1);
-			
-			if(command_byte == META_EVENT) {
-				t_1byte meta_event_type;
-				fread(&meta_event_type, sizeof(meta_event_type), 1, file_ptr);
-				bool event_is_unknown_type = true;
-				int meta_event_length = 0;
-				for(int i = 0; i<15; i++) {
-					if(meta_event_type == META_EVENT_TYPE_ARR[i]) {
-						printf("\tMeta command: %s\n", META_EVENT_NAME_ARR[i]);
-						printf("\tLength: %d\n", META_EVENT_LENGTH_ARR[i]);
-						meta_event_length = META_EVENT_LENGTH_ARR[i];
-						event_is_unknown_type = false;
-						break;
-					}
-				}
-				if(event_is_unknown_type) die("Unknown Midi Meta event type.");
-				if(meta_event_type == END_OF_TRACK) {
-					t_1byte jump_data_len_byte;
-					fread(&jump_data_len_byte, sizeof(jump_data_len_byte), 1, file_ptr);
-					if(jump_data_len_byte != 0) die("End of track event has data length > 0. Should be 0. Exiting program.");
-					if(track >= number_of_tracks-1) {
-						fprintf(file_write_ptr, "\n\t\t\t]\n\t\t}\n\t]\n}");
-						goto quit;
-					} else {
-						fprintf(file_write_ptr, "\n\t\t\t]\n\t\t},\n");
-						break;
-					}
-				}
-				if(meta_event_length == -1) {
-					// undefined length string
-					t_1byte string_length;
-					fread(&string_length, sizeof(string_length), 1, file_ptr);
-					t_1byte string_buffer[string_length+1];
-					fread(string_buffer, sizeof(string_buffer[0]), string_length, file_ptr);
-					string_buffer[string_length] = '\0';
-					printf("\t%s\n", string_buffer);
-				} else if(meta_event_length == -2) {
-					// variable length
-					t_1byte meta_event_data_len;
-					fread(&meta_event_data_len, sizeof(meta_event_data_len), 1, file_ptr);
-					t_1byte jump_bytes[meta_event_data_len];
-					fread(jump_bytes, sizeof(jump_bytes[0]), meta_event_data_len, file_ptr);
-				} else {
-					t_1byte meta_event_data_len;
-					fread(&meta_event_data_len, sizeof(meta_event_data_len), 1, file_ptr);
-					t_1byte meta_event_value[meta_event_length];
-					fread(meta_event_value, sizeof(meta_event_value[0]), meta_event_length, file_ptr);
-					printf("\tData: ");
-					for(int i=0;i<meta_event_length;i++) {
-						printf("%u ", (unsigned char) meta_event_value[i]);
-					}
-					printf("\n");
-				}
-
-
-			} else if(command_byte == SYSEX_EVENT) {
-				printf("\tSYSEX EVENT\n\tjumping forward to end of event.\n");
-				t_1byte jump_byte=0;
-				while( jump_byte != SYSEX_EVENT_END ) {
-					if( fread(&jump_byte, sizeof(jump_byte), 1, file_ptr) == EOF ) die("Searched for end of SysEx event, but reached end of file.");
-				}
+			printf("Writing \"%s\" to \"%s\", another input has the same name.\n", f->filename_in, renamed);
+			free(f->filename_out);
+			f->filename_out = renamed;
+		}
+		*slot = kept;
+	}
+	b->number_of_files = kept;
+	free(table);
+}
+
+size_t *find_batch_output(size_t *table, size_t table_size, const batch *b, const char *filename_out) {
+	size_t slot = midi_hash(filename_out, strlen(filename_out), MIDI_HASH_SEED) & (table_size - 1);
+	while(table[slot] != 0 && strcmp(b->files[table[slot] - 1].filename_out, filename_out) != 0) {
+		slot = (slot + 1) & (table_size - 1);
+	}
+	return &table[slot];
+}
+
+int compare_batch_size(const void *a, const void *b) {
+	off_t size_a = ((const batch_file *)a)->size, size_b = ((const batch_file *)b)->size;
+	return size_a < size_b ? 1 : size_a > size_b ? -1 : 0;
+}
+
+bool is_midi_name(const char *name) {
+	const char *dot = strrchr(name, '.');
+	return dot != NULL && (strcasecmp(dot, ".mid") == 0 || strcasecmp(dot, ".midi") == 0 || strcasecmp(dot, ".smf") == 0);
+}
+
+// everything the output depends on besides the input bytes. Not the name, the
+// entries are stored without it, so the same file anywhere shares one entry
+unsigned long long cache_key(const unsigned char *data, size_t size, bool binary, json_layout layout, midi_notes_order note_order, bool absolute_time, bool shortest_floats) {
+	char options[128];
+	snprintf(options, sizeof(options), "midi2json 2 bin=%d layout=%d order=%d ms=%d shortest=%d", binary, layout, note_order, absolute_time, shortest_floats);
+	return midi_cache_key(data, size, options);
+}
+
+// midi_cache_splice, writes the start of an output with the name in the json
+// description or the bin header replaced. -1 if the name found is not name->from
+long replace_cache_name(void *user, const unsigned char *start, size_t size, midi_writer *out) {
+	const cache_name *name = user;
+	if(name->binary) return midi_bin_rename(out, start, size, name->to);
+	size_t head_len = strlen(JSON_HEAD), from_len = strlen(name->from);
+	if(size < head_len + from_len + 2 || memcmp(start, JSON_HEAD, head_len) != 0) return -1;
+	if(memcmp(start + head_len, name->from, from_len) != 0 || memcmp(start + head_len + from_len, "\",", 2) != 0) return -1;
+	midi_writer_string(out, JSON_HEAD);
+	midi_writer_string(out, name->to);
+	return head_len + from_len;
+}
+
+void close_cache(midi_cache *cache) {
+	unsigned long long hits = cache->hits, misses = cache->misses;
+	if(midi_cache_close(cache) < 0) printf("Could not update the cache statistics: %s\n", cache->error);
+	printf("Cache: %llu hits, %llu misses (all runs: %llu hits, %llu misses, %llu bytes)\n", hits, misses, cache->total_hits, cache->total_misses, cache->total_bytes);
+}
+
+// bytes, with an optional K, M or G
+unsigned long long parse_size(const char *text) {
+	char *end;
+	unsigned long long size = strtoull(text, &end, 10);
+	if(*end == 'K' || *end == 'k') size <<= 10;
+	if(*end == 'M' || *end == 'm') size <<= 20;
+	if(*end == 'G' || *end == 'g') size <<= 30;
+	if(end == text || (*end != '\0' && end[1] != '\0')) die("Size must be given in bytes, with an optional K, M or G.");
+	return size;
+}
+
+// --serve, converts the requests on socket_path until the process is stopped
+void serve(const char *socket_path) {
+	build_note_fragments();
+	int listen_fd = midi_serve_listen(socket_path);
+	if(listen_fd < 0) die("Could not listen on the socket.");
+	int number_of_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if(number_of_workers < 1) number_of_workers = 1;
+	serve_worker *workers = calloc(number_of_workers, sizeof(serve_worker));
+	if(workers == NULL) die("Out of memory.");
+	for(int i = 0; i < number_of_workers; i++) {
+		workers[i].listen_fd = listen_fd;
+		if(midi_writer_init(&workers[i].out, -1) < 0) die("Out of memory.");
+	}
+	printf("Serving on %s, workers: %d.\n", socket_path, number_of_workers);
+	fflush(stdout);
+	// every worker takes the next connection as soon as it is free, they only return when accept fails
+	midi_parallel_for(number_of_workers, number_of_workers, serve_connections, workers);
+	die("Could not accept connections.");
+}
+
+void serve_connections(void *ctx, int index) {
+	serve_worker *w = &((serve_worker *)ctx)[index];
+	for(;;) {
+		int fd = accept(w->listen_fd, NULL, NULL);
+		if(fd < 0 && (errno == EINTR || errno == ECONNABORTED)) continue;
+		if(fd < 0) return;
+		// the requests of a connection are answered in order
+		while(midi_serve_read_request(fd, &w->request) == 0) {
+			if(serve_request(w, fd) < 0) break;
+		}
+		close(fd);
+	}
+}
+
+// converts one request into w->out and sends it back, returns -1 when the client is gone
+int serve_request(serve_worker *w, int fd) {
+	midi_serve_request *r = &w->request;
+	char *log_data = NULL;
+	size_t log_size = 0;
+	FILE *log = open_memstream(&log_data, &log_size);
+	if(log == NULL) return -1;
+	w->out.len = 0;
+	w->out.failed = false;
+	w->out.shortest_floats = r->flags & MIDI_SERVE_SHORTEST_FLOATS;
+
+	const char *error = NULL;
+	bool absolute_time = r->flags & MIDI_SERVE_ABSOLUTE_TIME;
+	if(r->layout > MIDI_SERVE_NOTES || r->note_order > MIDI_NOTES_LIFO) error = "Unknown option.";
+	if(r->layout == MIDI_SERVE_NOTES && ((r->flags & MIDI_SERVE_BIN) || absolute_time)) error = "Notes work with the json output, without absolute times.";
+	// a path is read here, only clients on the same machine send one
+	midi_reader in = { .data = r->data, .size = r->data_size };
+	bool is_opened = error == NULL && r->path[0] != '\0' && strcmp(r->path, "-") != 0 && midi_reader_open(&in, r->path) == 0;
+	if(error == NULL && r->path[0] != '\0' && !is_opened) error = "File not found.";
+	// there is a worker per cpu already, the tracks of a request are done in turn on this one
+	midi_song song;
+	midi_song_init(&song);
+	if(error == NULL && midi_song_load_threads(&song, in.data, in.size, 1) < 0) error = song.error;
+	if(error == NULL && (r->flags & MIDI_SERVE_BIN)) {
+		fprintf(log, "Number of tracks: %u\n", song.number_of_tracks);
+		fprintf(log, "Number of events: %zu\n", song.number_of_events);
+		midi_bin_write(&w->out, &song, r->name);
+	} else if(error == NULL && (error = check_song(&song)) == NULL) {
+		json_output output = { .out = &w->out, .log = log, .filename_in = r->name, .layout = SERVE_LAYOUT_ARR[r->layout], .note_order = r->note_order, .absolute_time = absolute_time, .max_threads = 1 };
+		write_song(&song, &output, NULL);
+		midi_writer_string(&w->out, "\n\t]\n}");
+	}
+	if(error == NULL && w->out.failed) error = "Out of memory.";
+	midi_song_free(&song);
+	if(is_opened) midi_reader_close(&in);
+	fclose(log);
+
+	int result = error != NULL
+		? midi_serve_send_response(fd, 1, log_data, log_size, error, strlen(error))
+		: midi_serve_send_response(fd, 0, log_data, log_size, w->out.data, w->out.len);
+	free(log_data);
+	// warm for the next request, unless this one was unusually large
+	if(w->out.capacity > SERVE_KEEP_SIZE || w->out.failed) {
+		midi_writer_free(&w->out);
+		if(midi_writer_init(&w->out, -1) < 0) result = -1;
+	}
+	if(r->data_capacity > SERVE_KEEP_SIZE) {
+		free(r->data);
+		r->data = NULL;
+		r->data_capacity = 0;
+	}
+	errno = 0;
+	return result;
+}
+
+// what writing the json would end the program for, the server must not
+const char *check_song(const midi_song *song) {
+	if(song->format > 2) return "Unknown Midi-file format.";
+	for(size_t i = 0; i < song->number_of_meta; i++) {
+		const midi_song_payload *meta = &song->meta[i];
+		int type = song->data1[meta->event];
+		if(type >= 128 || META_EVENT_INDEX_ARR[type] < 0) return "Unknown Midi Meta event type.";
+		if(type == END_OF_TRACK && meta->length != 0) return "End of track event has data length > 0.";
+	}
+	return NULL;
+}
+
+// mkdir -p for the directories of path
+int make_parent_dirs(const char *path) {
+	char *dir = strdup(path);
+	if(dir == NULL) return -1;
+	int result = 0;
+	for(char *slash = strchr(dir + 1, '/'); slash != NULL && result == 0; slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		if(mkdir(dir, 0777) < 0 && errno != EEXIST) result = -1;
+		*slash = '/';
+	}
+	free(dir);
+	return result;
+}
+
+void write_song_track(void *ctx, int track) {
+	song_output *s = ctx;
+	const midi_song *song = s->song;
+	const midi_song_track *t = &song->tracks[track];
+	json_output *o = &s->tracks[track].output;
+	if(s->fragments != NULL && s->fragments->reused[track] != NULL) return;
+
+	write_track_begin(o, track, t->length);
+	const midi_song_payload *meta = song->meta + t->first_meta;
+	for(size_t e = t->first_event; e < t->first_event + t->number_of_events; e++) {
+		if(song->status[e] == META_EVENT) {
+			write_meta_event(o, song->data1[e], midi_song_payload_data(song, meta), meta->length);
+			meta++;
+		} else if(MIDI_STATUS_TABLE[song->status[e]].kind == MIDI_STATUS_SYSEX) {
+			write_sysex_event(o);
+		} else if(o->layout == LAYOUT_ROWS) {
+			write_channel_event(o, song->status[e], song->data1[e], song->data2[e], midi_song_delta(song, e), song->tick[e]);
+		}
+	}
+	if(o->layout == LAYOUT_COLUMNS) write_track_columns(o, song, t);
+	if(o->layout == LAYOUT_NOTES) write_track_notes(o, song, t);
+	write_track_end(o);
+	if(s->fragments != NULL && midi_fragments_write(s->fragments->store, s->fragments->keys[track], o->out->data, o->out->len) < 0) {
+		s->tracks[track].fragment_failed = true;
+	}
+}
 
+// while streaming the tempo map is built as the tempo events go by, they
+// always come before the events they apply to
+void follow_tempo(json_output *o, const midi_event *ev) {
+	if(o->tempo == NULL || o->tempo_fixed) return;
+	if(ev->kind == MIDI_EVENT_HEADER) {
+		midi_tempo_map_init(o->tempo, ev->division);
+		o->format = ev->format;
+	} else if(ev->kind == MIDI_EVENT_TRACK_BEGIN && o->format == 2) {
+		o->tempo->number_of_changes = 0;
+	} else if(ev->kind == MIDI_EVENT_META && ev->type == SET_TEMPO && (ev->track == 0 || o->format == 2)) {
+		if(midi_tempo_map_add(o->tempo, ev->tick, midi_tempo_value(ev->payload, ev->payload_len)) < 0) die("Out of memory.");
+	}
+}
+
+int write_parsed_event(void *user, const midi_event *ev) {
+	json_output *o = user;
+	follow_tempo(o, ev);
+	switch(ev->kind) {
+	case MIDI_EVENT_HEADER:
+		write_header(o, ev->header_size, ev->format, ev->number_of_tracks, ev->division);
+		break;
+	case MIDI_EVENT_TRACK_BEGIN:
+		write_track_begin(o, ev->track, ev->track_length);
+		break;
+	case MIDI_EVENT_CHANNEL:
+		write_channel_event(o, ev->status, ev->data[0], ev->data[1], ev->delta, ev->tick);
+		break;
+	case MIDI_EVENT_META:
+		write_meta_event(o, ev->type, ev->payload, ev->payload_len);
+		break;
+	case MIDI_EVENT_SYSEX:
+		write_sysex_event(o);
+		break;
+	case MIDI_EVENT_TRACK_END:
+		write_track_end(o);
+		break;
+	}
+	return 0;
+}
+
+int write_ndjson_event(void *user, const midi_event *ev) {
+	json_output *o = user;
+	midi_writer *out = o->out;
+	follow_tempo(o, ev);
+	switch(ev->kind) {
+	case MIDI_EVENT_HEADER:
+		log_header(o->log, ev->header_size, ev->format, ev->number_of_tracks, ev->division);
+		midi_writer_format(out, "{\"type\":\"header\",\"file\":\"%s\",\"format\":%u,\"tracks\":%u,\"division\":%u}\n",
+			o->filename_in, ev->format, ev->number_of_tracks, ev->division);
+		break;
+	case MIDI_EVENT_TRACK_BEGIN:
+		log_track_begin(o->log, ev->track, ev->track_length);
+		o->tempo_cursor = 0;
+		midi_writer_string(out, "{\"type\":\"track\",\"track\":");
+		midi_writer_uint(out, ev->track+1);
+		midi_writer_string(out, ",\"length\":");
+		midi_writer_uint(out, ev->track_length);
+		midi_writer_string(out, "}\n");
+		break;
+	case MIDI_EVENT_CHANNEL:
+		if(get_low_bits(ev->status) >= 16) die("Read midi event with channel above limit 16.");
+		midi_writer_string(out, "{\"type\":\"note\",\"track\":");
+		midi_writer_uint(out, ev->track+1);
+		midi_writer_string(out, ",\"tick\":");
+		midi_writer_uint(out, ev->tick);
+		if(o->tempo != NULL) {
+			midi_writer_string(out, ",\"ms\":");
+			midi_writer_fixed(out, midi_tempo_ms(o->tempo, &o->tempo_cursor, ev->tick), MS_DECIMALS);
+		}
+		midi_writer_string(out, ",\"c\":\"");
+		midi_writer_string(out, MIDI_EVENT_NAME_ARR[MIDI_STATUS_TABLE[ev->status].command]);
+		midi_writer_string(out, "\",\"n\":");
+		midi_writer_uint(out, ev->data[0]);
+		midi_writer_string(out, ",\"v\":");
+		midi_writer_uint(out, ev->data[1]);
+		midi_writer_string(out, "}\n");
+		break;
+	case MIDI_EVENT_META:
+		write_meta_event(o, ev->type, ev->payload, ev->payload_len);
+		return 0;
+	case MIDI_EVENT_SYSEX:
+		write_sysex_event(o);
+		return 0;
+	case MIDI_EVENT_TRACK_END:
+		midi_writer_string(out, "{\"type\":\"track_end\",\"track\":");
+		midi_writer_uint(out, ev->track+1);
+		midi_writer_string(out, ",\"tick\":");
+		midi_writer_uint(out, ev->tick);
+		midi_writer_string(out, "}\n");
+		o->tracks_written++;
+		if(o->flush == FLUSH_TRACK) midi_writer_flush(out);
+		break;
+	}
+	if(o->flush == FLUSH_EVENT) midi_writer_flush(out);
+	// a failed write (e.g. the reader went away) ends the parse
+	return out->failed ? -1 : 0;
+}
+
+void log_header(FILE *log, unsigned int header_size, unsigned short format, unsigned short number_of_tracks, unsigned short division) {
+	fprintf(log, "%s\n", FILE_HEADER);
+	fprintf(log, "Midi file header signature ok.\n");
+	fprintf(log, "Header info:\n");
+	fprintf(log, "\tFile header size: %u\n", header_size);
+	if(format == 0) {
+		fprintf(log, "\tFile format: 0 (single track)\n");
+	} else if(format == 1) {
+		fprintf(log, "\tFile format: 1 (multiple tracks)\n");
+	} else if(format == 2) {
+		fprintf(log, "\tFile format: 2 (independent tracks)\n");
+	} else {
+		die("Ending program, unknown Midi-file format: %u");
+	}
+	fprintf(log, "\tNumber of tracks: %u\n", number_of_tracks);
+	fprintf(log, "\tDelta time ticks: %u\n", division);
+	fprintf(log, "\tTicks per second: %u\n", ticks_per_second(division, 60));
+}
+
+void log_track_begin(FILE *log, int track, size_t length) {
+	fprintf(log, "Track %u:\n", track+1);
+	fprintf(log, "\tMidi track header signature: %s\n", TRACK_HEADER);
+	fprintf(log, "\tTrack length: %zu\n", length);
+}
+
+void write_header(json_output *o, unsigned int header_size, unsigned short format, unsigned short number_of_tracks, unsigned short division) {
+	log_header(o->log, header_size, format, number_of_tracks, division);
+
+	if(o->layout == LAYOUT_COLUMNS) {
+		midi_writer_format(o->out, "%s%s\",\n\t\"keys\":\"[cmd] command code, index into commands, [note] midi-note, [delta] delta-time, [vel] velocity, frequencies are indexed by midi-note\",\n", JSON_HEAD, o->filename_in);
+		midi_writer_string(o->out, "\t\"info\":\"converted using midi2json by superpanic, https://github.com/superpanic\",\n");
+		// the lookup tables the codes in the track columns refer to
+		midi_writer_string(o->out, "\t\"commands\":[");
+		for(int command = 0; command < 7; command++) {
+			if(command > 0) midi_writer_char(o->out, ',');
+			midi_writer_char(o->out, '"');
+			midi_writer_string(o->out, MIDI_EVENT_NAME_ARR[command]);
+			midi_writer_char(o->out, '"');
+		}
+		midi_writer_string(o->out, "],\n\t\"frequencies\":[");
+		for(int note = 0; note < 128; note++) {
+			if(note > 0) midi_writer_char(o->out, ',');
+			midi_writer_float(o->out, MIDI_NOTE_FREQUENCY_ARR[note]);
+		}
+		midi_writer_string(o->out, "],\n");
+	} else if(o->layout == LAYOUT_NOTES) {
+		midi_writer_format(o->out, "%s%s\",\n\t\"keys\":\"[start] start tick, [duration] duration in ticks, [key] midi-note, [velocity] velocity, [channel] channel, [dangling] true if the note has no Note OFF\",\n", JSON_HEAD, o->filename_in);
+		midi_writer_string(o->out, "\t\"info\":\"converted using midi2json by superpanic, https://github.com/superpanic\",\n");
+	} else {
+		midi_writer_format(o->out, "%s%s\",\n\t\"keys\":\"[c] command, [n] midi-note, [d] delta-time, [f] frequency, [v] velocity\",\n", JSON_HEAD, o->filename_in);
+		midi_writer_string(o->out, "\t\"info\":\"converted using midi2json by superpanic, https://github.com/superpanic\",\n");
+	}
+	if(o->merged) {
+		midi_writer_string(o->out, "\t\"merged\":\"[t] track, all tracks in one timeline, [d] counts from the event before in any track\",\n");
+		midi_writer_string(o->out, "\t\"events\":[\n");
+		o->is_first_midi_event = true;
+	} else {
+		midi_writer_string(o->out, "\t\"tracks\":[\n");
+	}
+}
+
+void write_track_begin(json_output *o, int track, size_t length) {
+	log_track_begin(o->log, track, length);
+
+	if(o->tracks_written > 0) midi_writer_string(o->out, ",\n");
+	midi_writer_string(o->out, "\t\t{");
+	midi_writer_string(o->out, "\n\t\t\t\"track number\":");
+	midi_writer_uint(o->out, track+1);
+	if(o->layout != LAYOUT_COLUMNS) midi_writer_string(o->out, ",\n\t\t\t\"notes\":[\n");
+	o->is_first_midi_event = true;
+	o->tempo_cursor = 0;
+}
+
+void write_track_end(json_output *o) {
+	if(o->layout != LAYOUT_COLUMNS) midi_writer_string(o->out, "\n\t\t\t]");
+	midi_writer_string(o->out, "\n\t\t}");
+	o->tracks_written++;
+}
 
+// the channel events of a track as four parallel arrays, one pass over the song columns each
+void write_track_columns(json_output *o, const midi_song *song, const midi_song_track *t) {
+	static const char *COLUMN_NAME_ARR[5] = { "cmd", "note", "delta", "vel", "ms" };
+	midi_writer *out = o->out;
+	size_t end = t->first_event + t->number_of_events;
+	int number_of_columns = o->tempo != NULL ? 5 : 4;
+	for(int column = 0; column < number_of_columns; column++) {
+		midi_writer_string(out, ",\n\t\t\t\"");
+		midi_writer_string(out, COLUMN_NAME_ARR[column]);
+		midi_writer_string(out, "\":[");
+		bool is_first = true;
+		for(size_t e = t->first_event; e < end; e++) {
+			const midi_status_entry *entry = &MIDI_STATUS_TABLE[song->status[e]];
+			if(entry->kind != MIDI_STATUS_CHANNEL) continue;
+			if(!is_first) midi_writer_char(out, ',');
+			is_first = false;
+			if(column == 0) {
+				midi_writer_uint(out, entry->command);
+			} else if(column == 1) {
+				midi_writer_uint(out, song->data1[e]);
+			} else if(column == 2) {
+				midi_writer_uint(out, midi_song_delta(song, e));
+			} else if(column == 3) {
+				midi_writer_uint(out, song->data2[e]);
 			} else {
-				if (DEBUG) printf("\tMIDI EVENT: ");
-				if (DEBUG) printf("[0x%02x] ", (unsigned char) command_byte);
-				int midi_command = get_high_bits(command_byte);
-				int midi_channel = get_low_bits(command_byte);
-				if(midi_channel>=16) die("Read midi event with channel above limit 16.");
-
-				if(!is_first_midi_event) {
-					fprintf(file_write_ptr, ",\n");
-				} else {
-					is_first_midi_event = false;
-				}
-
-				bool event_is_unknown_type = true;
-				int midi_data_len = 0;
-				int midi_event_number = 0;
-				for(int i=0; i<7; i++) {
-					if(midi_command == MIDI_EVENT_COMMAND_ARR[i]) {
-						if (DEBUG) printf("%s, channel: %d\n", MIDI_EVENT_NAME_ARR[i], midi_channel);
-						midi_data_len = MIDI_EVENT_LENGTH_ARR[i];
-						if (DEBUG) printf("\tmidi data length: %d\n", midi_data_len);
-						midi_event_number = i;
-						event_is_unknown_type = false;
-					}
-				}
-				if(event_is_unknown_type) die("Unknown midi event type.");
-				
-				t_1byte midi_data[midi_data_len];
-				fread(midi_data, sizeof(midi_data[0]), midi_data_len, file_ptr);
-
-				if (DEBUG) printf("\t");
-				for(int i=0; i<midi_data_len; i++) {
-					if (DEBUG) printf("%u ", (unsigned char) midi_data[i]);
-					if (DEBUG) printf("[0x%02x] ", (unsigned char) midi_data[i]);
-				}
-				if (DEBUG) printf("\n");
-				
-				fprintf(file_write_ptr, "\t\t\t\t{\"c\":\"%s\", \"n\":%u, \"d\":%u, \"f\":%f, \"v\":%u}", 
-					MIDI_EVENT_NAME_ARR[midi_event_number], 
-					(unsigned char)midi_data[0], 
-					delta_time_value, 
-					MIDI[(unsigned char)midi_data[0]], 
-					(unsigned char)midi_data[1]);
-
-				if(DEBUG) printf("{\"command\":\"%s\", \"note\":%u, \"delta\":%u, \"freq\":%f, \"velo\":%u},\n", 
-					MIDI_EVENT_NAME_ARR[midi_event_number], 
-					(unsigned char)midi_data[0], 
-					delta_time_value, 
-					MIDI[(unsigned char)midi_data[0]], 
-					(unsigned char)midi_data[1]
-				);
+				midi_writer_fixed(out, midi_tempo_ms(o->tempo, &o->tempo_cursor, song->tick[e]), MS_DECIMALS);
 			}
+		}
+		midi_writer_char(out, ']');
+	}
+}
 
-			// debug
-			int debug_limit_read_length = 40;
-			
-			if(DEBUG && event >= debug_limit_read_length) {
-				printf("Debug mode with limited read length to %d. ", debug_limit_read_length);
-				die("Exiting now.");
-			}
+void write_track_notes(json_output *o, const midi_song *song, const midi_song_track *t) {
+	size_t end = t->first_event + t->number_of_events;
+	size_t number_of_notes = 0;
+	for(size_t e = t->first_event; e < end; e++) {
+		if(get_high_bits(song->status[e]) == NOTE_ON && MIDI_STATUS_TABLE[song->status[e]].kind == MIDI_STATUS_CHANNEL && song->data2[e] > 0) number_of_notes++;
+	}
+	note_output ctx = { .output = o, .notes = calloc(number_of_notes > 0 ? number_of_notes : 1, sizeof(midi_note)) };
+	midi_notes *pairing = malloc(sizeof(midi_notes));
+	if(ctx.notes == NULL || pairing == NULL) die("Out of memory.");
 
+	midi_notes_init(pairing, o->note_order, place_note, &ctx);
+	for(size_t e = t->first_event; e < end; e++) {
+		if(MIDI_STATUS_TABLE[song->status[e]].kind != MIDI_STATUS_CHANNEL) continue;
+		midi_notes_event(pairing, song->tick[e], song->status[e], song->data1[e], song->data2[e]);
+	}
+	midi_notes_finish(pairing, t->number_of_events > 0 ? song->tick[end - 1] : 0);
+	if(pairing->number_of_dangling > 0) fprintf(o->log, "\tDangling notes: %u\n", pairing->number_of_dangling);
 
-		} // end event for loop
-	} // end track for loop
+	midi_writer *out = o->out;
+	for(size_t i = 0; i < number_of_notes; i++) {
+		const midi_note *note = &ctx.notes[i];
+		if(i > 0) midi_writer_string(out, ",\n");
+		midi_writer_string(out, "\t\t\t\t{\"start\":");
+		midi_writer_uint(out, note->start);
+		midi_writer_string(out, ", \"duration\":");
+		midi_writer_uint(out, note->duration);
+		midi_writer_string(out, ", \"key\":");
+		midi_writer_uint(out, note->key);
+		midi_writer_string(out, ", \"velocity\":");
+		midi_writer_uint(out, note->velocity);
+		midi_writer_string(out, ", \"channel\":");
+		midi_writer_uint(out, note->channel);
+		if(note->kind != MIDI_NOTE_PAIRED) midi_writer_string(out, ", \"dangling\":true");
+		midi_writer_char(out, '}');
+	}
+	free(pairing);
+	free(ctx.notes);
+}
 
-	quit:
-		fclose(file_write_ptr);
-		fclose(file_ptr);
-		die("End of program.");
-		return 0;
+void place_note(void *user, const midi_note *note) {
+	note_output *ctx = user;
+	FILE *log = ctx->output->log;
+	switch(note->kind) {
+	case MIDI_NOTE_PAIRED:
+		break;
+	case MIDI_NOTE_UNCLOSED:
+		fprintf(log, "\tDangling note: key %u, channel %u, tick %u, no Note OFF before the end of the track.\n", note->key, note->channel, note->start);
+		break;
+	case MIDI_NOTE_TRUNCATED:
+		fprintf(log, "\tDangling note: key %u, channel %u, tick %u, ended after %d overlapping Note ON.\n", note->key, note->channel, note->start, MIDI_NOTES_MAX_OVERLAP);
+		break;
+	case MIDI_NOTE_STRAY_OFF:
+		fprintf(log, "\tDangling note: key %u, channel %u, tick %u, Note OFF without a Note ON.\n", note->key, note->channel, note->start);
+		return;
+	}
+	ctx->notes[note->index] = *note;
 }
 
-unsigned char get_low_bits(unsigned char c) {
-	return c & 0x0F;
+void write_meta_event(json_output *o, int type, const t_1byte *payload, size_t payload_len) {
+	int meta_index = type < 128 ? META_EVENT_INDEX_ARR[type] : -1;
+	if(meta_index < 0) die("Unknown Midi Meta event type.");
+	fprintf(o->log, "\tMeta command: %s\n", META_EVENT_NAME_ARR[meta_index]);
+	fprintf(o->log, "\tLength: %d\n", META_EVENT_LENGTH_ARR[meta_index]);
+	int meta_event_length = META_EVENT_LENGTH_ARR[meta_index];
+	if(type == END_OF_TRACK) {
+		if(payload_len != 0) die("End of track event has data length > 0. Should be 0. Exiting program.");
+	} else if(meta_event_length == -1) {
+		// undefined length string
+		fprintf(o->log, "\t%.*s\n", (int)strnlen((const char *)payload, payload_len), payload);
+	} else if(meta_event_length >= 0) {
+		fprintf(o->log, "\tData: ");
+		for(int i=0;i<payload_len;i++) {
+			fprintf(o->log, "%u ", (unsigned char) payload[i]);
+		}
+		fprintf(o->log, "\n");
+	}
 }
 
-unsigned char get_high_bits(unsigned char c) {
-	return c >> 4;
+void write_sysex_event(json_output *o) {
+	fprintf(o->log, "\tSYSEX EVENT\n\tjumping forward to end of event.\n");
 }
 
-unsigned short reverse_endian_short(unsigned short x) {
-	return (
-		( (x >> 8) & 0x00ff ) | 
-		( (x << 8) & 0xff00 )
+void write_channel_event(json_output *o, t_1byte status, t_1byte data1, t_1byte data2, unsigned int delta, unsigned int tick) {
+	if (DEBUG) printf("\tMIDI EVENT: ");
+	if (DEBUG) printf("[0x%02x] ", (unsigned char) status);
+	int midi_channel = get_low_bits(status);
+	if(midi_channel>=16) die("Read midi event with channel above limit 16.");
+
+	if(!o->is_first_midi_event) {
+		midi_writer_string(o->out, ",\n");
+	} else {
+		o->is_first_midi_event = false;
+	}
+
+	int midi_event_number = MIDI_STATUS_TABLE[status].command;
+	if (DEBUG) printf("%s, channel: %d\n", MIDI_EVENT_NAME_ARR[midi_event_number], midi_channel);
+
+	const json_fragment *prefix = &NOTE_PREFIX_ARR[midi_event_number][data1];
+	const json_fragment *frequency = &NOTE_FREQUENCY_ARR[o->out->shortest_floats][data1];
+	midi_writer *out = o->out;
+	midi_writer_bytes(out, prefix->text, prefix->len);
+	midi_writer_uint(out, delta);
+	midi_writer_bytes(out, frequency->text, frequency->len);
+	midi_writer_uint(out, data2);
+	if(o->tempo != NULL) {
+		midi_writer_string(out, ", \"ms\":");
+		midi_writer_fixed(out, midi_tempo_ms(o->tempo, &o->tempo_cursor, tick), MS_DECIMALS);
+	}
+	midi_writer_char(out, '}');
+
+	if(DEBUG) printf("{\"command\":\"%s\", \"note\":%u, \"delta\":%u, \"freq\":%f, \"velo\":%u},\n",
+		MIDI_EVENT_NAME_ARR[midi_event_number],
+		data1,
+		delta,
+		MIDI_NOTE_FREQUENCY_ARR[data1],
+		data2
 	);
 }
 
-unsigned int reverse_endian_int(unsigned int x) {
-	return (
-		( (x >> 24) & 0x000000ff ) | 
-		( (x >>  8) & 0x0000ff00 ) | 
-		( (x <<  8) & 0x00ff0000 ) | 
-		( (x << 24) & 0xff000000 )
-	);
+void build_note_fragments() {
+	midi_writer w;
+	if(midi_writer_init(&w, -1) < 0) die("Out of memory.");
+	for(int note = 0; note < 128; note++) {
+		for(int command = 0; command < 7; command++) {
+			w.len = 0;
+			midi_writer_string(&w, "\t\t\t\t{\"c\":\"");
+			midi_writer_string(&w, MIDI_EVENT_NAME_ARR[command]);
+			midi_writer_string(&w, "\", \"n\":");
+			midi_writer_uint(&w, note);
+			midi_writer_string(&w, ", \"d\":");
+			memcpy(NOTE_PREFIX_ARR[command][note].text, w.data, w.len);
+			NOTE_PREFIX_ARR[command][note].len = w.len;
+		}
+		// both float styles, the server is asked for either
+		for(int shortest = 0; shortest < 2; shortest++) {
+			w.len = 0;
+			w.shortest_floats = shortest;
+			midi_writer_string(&w, ", \"f\":");
+			midi_writer_float(&w, MIDI_NOTE_FREQUENCY_ARR[note]);
+			midi_writer_string(&w, ", \"v\":");
+			memcpy(NOTE_FREQUENCY_ARR[shortest][note].text, w.data, w.len);
+			NOTE_FREQUENCY_ARR[shortest][note].len = w.len;
+		}
+	}
+	midi_writer_free(&w);
 }
 
 void die(const char *message) {
@@ -403,20 +1662,3 @@ void print_type_lengths() {
 	printf("  %lu bytes (unsigned long)  : t_8byte\n", sizeof(t_8byte));
 	printf("================\n");
 }
-
-void generate_frequencies(float *mi, int len) {
-	float C1 = 8.1757989156; // first C frequency
-	mi[0] = C1;
-	for (int x = 1; x < len; x++) {
-		mi[x] = mi[x-1] * 1.05946309436; // twelfth root of 2
-	}
-}
-
-unsigned int ticks_per_second(unsigned int ticks_per_beat, unsigned int beats_per_minute) {
-	int ticks_per_minute = beats_per_minute * ticks_per_beat;
-	int ticks_per_second = ticks_per_minute / 60;
-	return ticks_per_second;
-}
-
-
-
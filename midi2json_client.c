@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "midi_common.h"
+#include "midi_reader.h"
+#include "midi_notes.h"
+#include "midi_serve.h"
+
+void die(const char *message);
+int write_all(int fd, const char *data, size_t size);
+
+int main(int argc, char *argv[]) {
+	// the same arguments as midi2json, the conversion runs in midi2json --serve
+	const char *files[2];
+	int number_of_files = 0;
+	const char *socket_path = getenv("MIDI2JSON_SOCKET");
+	midi_serve_request request = { .layout = MIDI_SERVE_ROWS, .note_order = MIDI_NOTES_FIFO };
+	for(int i = 1; i < argc; i++) {
+		if(strncmp(argv[i], "--", 2) != 0) {
+			if(number_of_files < 2) files[number_of_files] = argv[i];
+			number_of_files++;
+		} else if(strncmp(argv[i], "--socket=", 9) == 0) {
+			socket_path = argv[i] + 9;
+		} else if(strcmp(argv[i], "--shortest-floats") == 0) {
+			request.flags |= MIDI_SERVE_SHORTEST_FLOATS;
+		} else if(strcmp(argv[i], "--format=json") == 0) {
+			request.flags &= ~MIDI_SERVE_BIN;
+		} else if(strcmp(argv[i], "--format=bin") == 0) {
+			request.flags |= MIDI_SERVE_BIN;
+		} else if(strcmp(argv[i], "--layout=rows") == 0) {
+			request.layout = MIDI_SERVE_ROWS;
+		} else if(strcmp(argv[i], "--layout=columnar") == 0) {
+			request.layout = MIDI_SERVE_COLUMNS;
+		} else if(strcmp(argv[i], "--notes") == 0 || strcmp(argv[i], "--notes=fifo") == 0) {
+			request.layout = MIDI_SERVE_NOTES;
+			request.note_order = MIDI_NOTES_FIFO;
+		} else if(strcmp(argv[i], "--notes=lifo") == 0) {
+			request.layout = MIDI_SERVE_NOTES;
+			request.note_order = MIDI_NOTES_LIFO;
+		} else if(strcmp(argv[i], "--absolute-time") == 0) {
+			request.flags |= MIDI_SERVE_ABSOLUTE_TIME;
+		} else {
+			die("Unknown option, the server converts with --format, --layout, --notes, --absolute-time and --shortest-floats.");
+		}
+	}
+	if(number_of_files < 2) die("Please provide [FILENAME_IN] and [FILENAME_OUT].");
+	if(socket_path == NULL) die("Please provide --socket=SOCKET or set MIDI2JSON_SOCKET.");
+	const char *filename_in = files[0];
+	const char *filename_out = files[1];
+
+	int stdout_fd = -1;
+	if(strcmp(filename_out, "-") == 0) {
+		// output to stdout, the log moves over to stderr
+		stdout_fd = dup(STDOUT_FILENO);
+		if(stdout_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) die("Failed to create new file.");
+	}
+
+	printf("Opening file %s\n", filename_in);
+	// the server reads files itself, stdin and pipes are sent along
+	request.name = (char *)filename_in;
+	midi_reader in = { 0 };
+	if(midi_reader_is_stream(filename_in)) {
+		if(midi_reader_open(&in, filename_in) < 0) die("Failed to read input.");
+		request.data = (unsigned char *)in.data;
+		request.data_size = in.size;
+	} else {
+		request.path = realpath(filename_in, NULL);
+		if(request.path == NULL) die("File not found.");
+	}
+	printf("File \"%s\" open for reading.\n", filename_in);
+
+	int fd = midi_serve_connect(socket_path);
+	if(fd < 0) die("Could not connect to the server.");
+	midi_serve_response response;
+	if(midi_serve_send_request(fd, &request) < 0 || midi_serve_read_response(fd, &response) < 0) die("Lost the connection to the server.");
+	close(fd);
+	free(request.path);
+	midi_reader_close(&in);
+	errno = 0;
+
+	if(response.status != 0) {
+		fwrite(response.log, 1, response.log_size, stdout);
+		die(response.body);
+	}
+	int file_write_fd = stdout_fd >= 0 ? stdout_fd : open(filename_out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(file_write_fd < 0) die("Failed to create new file.");
+	printf("Created file \"%s\" for output.\n", filename_out);
+	fwrite(response.log, 1, response.log_size, stdout);
+	if(write_all(file_write_fd, response.body, response.body_size) < 0) die("Failed to write output.");
+	close(file_write_fd);
+	midi_serve_response_free(&response);
+	die("End of program.");
+	return 0;
+}
+
+int write_all(int fd, const char *data, size_t size) {
+	while(size > 0) {
+		ssize_t n = write(fd, data, size);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return -1;
+		data += n;
+		size -= n;
+	}
+	return 0;
+}
+
+void die(const char *message) {
+	if (errno) {
+		perror(message);
+	} else {
+		printf("PROGRAM END: %s\n", message);
+	}
+	exit(errno);
+}
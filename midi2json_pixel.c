@@ -5,435 +5,140 @@
 #include <stdbool.h>
 #include <math.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "midi_common.h"
+#include "midi_song.h"
+#include "midi_writer.h"
+#include "midi_pixel.h"
 
 #define DEBUG 0
-#define CLEAN 1
 #define TRACK_READ 0
-#define EMPTY 0
-
-#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
-#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
-
-typedef unsigned char  t_1byte;
-typedef unsigned short t_2byte;
-typedef unsigned int   t_4byte;
-typedef unsigned long  t_8byte;
 
 void die(const char *message);
 void print_type_lengths();
-void generate_frequencies(float *m, int len);
 
 int get_16_step(float t);
-int midiNoteToPOIndex(int midiNote, int baseNote, int adjustBaseNote);
-
-unsigned int reverse_endian_int(unsigned int x);
-unsigned short reverse_endian_short(unsigned short x);
-unsigned int ticks_per_second(unsigned int ticks_per_beat, unsigned int beats_per_minute);
-unsigned char get_low_bits(unsigned char c);
-unsigned char get_high_bits(unsigned char c);
+void log_track(const midi_song *song, int track);
 
 const int FILE_NAME_LEN = 128;
 
-const int META_EVENT      = 0xFF;
-const int SYSEX_EVENT     = 0xF0;
-const int SYSEX_EVENT_END = 0xF7;
-const int END_OF_TRACK    = 0x2F;
-const int NOTE_ON         = 0x9;
-const int NOTE_OFF 	  = 0x8;
-const int INSTRUMENT_NAME  = 0x03;
-
-const int BAR_TICKS = 1920;
-const int BARS = 2;
-const int MAX_STEPS = BARS * 16;
-const int STEP = (BAR_TICKS * BARS)/MAX_STEPS; //240;    // 3840/16 = 240
-
-
-
-float MIDI[127];
-
-const char *FILE_HEADER = "MThd";
-const char *TRACK_HEADER = "MTrk";
-
-const int DELTA_TIME_MAX_BYTES = 4;
-
-const int MIDI_EVENT_COMMAND_ARR[7] = {
-	0x8, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE
-};
-
-
-const char MIDI_EVENT_NAME_ARR[7][19] = {
-	"Note OFF",
-	"Note ON",
-	"Note Aftertouch",
-	"Controller",
-	"Program Change",
-	"Channel Aftertouch",
-	"Pitch Bend"
-};
-
-const char MIDI_EVENT_LENGTH_ARR[7] = {
-	2, 2, 2, 2, 1, 1, 2
-};
-
-const int META_EVENT_TYPE_ARR[15] = {
-	0x00, 0x01, 0x02, 0x03, 0x04, 
-	0x05, 0x06, 0x07, 0x20, 0x2F, 
-	0x51, 0x54, 0x58, 0x59, 0x7F
-};
-
-const int META_EVENT_LENGTH_ARR[15] = {
-	 2, -1, -1, -1, -1,
-	-1, -1, -1,  1,  0,
-	 3,  5,  4,  2, -2
-}; // -1 == string, -2 == variable length
-
-const char META_EVENT_NAME_ARR[15][20] = {
-	"Sequence Number",
-	"Text Event",
-	"Copyright Notice",
-	"Sequence/Track Name",
-	"Instrument Name",
-
-	"Lyrics",
-	"Marker",
-	"Cue Point",
-	"Midi Channel Prefix",
-	"End of Track",
-
-	"Set tempo",
-	"SMPTE Offset",
-	"Time Signature",
-	"Key Signature",
-	"Sequencer Specific"
-};
-
-
 int main(int argc, char *argv[]) {
 	if (DEBUG) print_type_lengths();
-	if (argc < 3) die("Please provide [FILENAME_IN] and [FILENAME_OUT].");
-	
+
+	// options start with "--", everything else is a file name
+	const char *files[2];
+	int number_of_files = 0;
+	midi_pixel_options options;
+	midi_pixel_options_init(&options);
+	for(int i = 1; i < argc; i++) {
+		if(strncmp(argv[i], "--", 2) != 0) {
+			if(number_of_files < 2) files[number_of_files] = argv[i];
+			number_of_files++;
+		} else if(strncmp(argv[i], "--grid=", 7) == 0) {
+			options.steps_per_bar = atoi(argv[i] + 7);
+		} else if(strncmp(argv[i], "--bars=", 7) == 0) {
+			options.bars = atoi(argv[i] + 7);
+		} else if(strncmp(argv[i], "--ppq=", 6) == 0) {
+			options.ppq = atoi(argv[i] + 6);
+		} else if(strcmp(argv[i], "--dedup") == 0) {
+			options.dedup = true;
+		} else {
+			die("Unknown option.");
+		}
+	}
+	if (number_of_files < 2) die("Please provide [FILENAME_IN] and [FILENAME_OUT].");
+	if(options.steps_per_bar <= 0 || options.bars <= 0) die("Grid and bars must be above 0.");
+
 	char filename_in[FILE_NAME_LEN];
-	strncpy(filename_in, argv[1], FILE_NAME_LEN);
+	strncpy(filename_in, files[0], FILE_NAME_LEN);
 	filename_in[FILE_NAME_LEN-1] = '\0';
 
 	char filename_out[FILE_NAME_LEN];
-	strncpy(filename_out, argv[2], FILE_NAME_LEN);
+	strncpy(filename_out, files[1], FILE_NAME_LEN);
 	filename_out[FILE_NAME_LEN-1] = '\0';
 
-	generate_frequencies(MIDI, 128);
-
-	FILE *file_ptr;
 	printf("Opening file %s\n", filename_in);
 
-	file_ptr = fopen(filename_in, "rb");
-	if(file_ptr == NULL) die("File not found.");
+	// decode the whole file up front, tracks in parallel
+	midi_song song;
+	midi_song_init(&song);
+	if(midi_song_load_file(&song, filename_in) < 0) die(song.error);
 	printf("File \"%s\" open for reading.\n", filename_in);
 
-	FILE *file_write_ptr;
-	file_write_ptr = fopen(filename_out, "w");
-	if(file_write_ptr == NULL) die("Failed to create new file.");
+	int file_write_fd = open(filename_out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(file_write_fd < 0) die("Failed to create new file.");
+	midi_writer out;
+	if(midi_writer_init(&out, file_write_fd) < 0) die("Out of memory.");
 	printf("Created file \"%s\" for output.\n", filename_out);
-		
-	// read file header MThd
-	int read_len = 4;
-	t_1byte file_header[read_len];
-	fread(file_header, sizeof(file_header[0]), read_len, file_ptr);
-	bool is_a_midi_file = true;
-	for(int i=0; i<read_len; i++) {
-		printf("%c", file_header[i]);
-		if(FILE_HEADER[i] != file_header[i]) {
-			is_a_midi_file = false;
-		}
-	}
-	printf("\n");
-	if (!is_a_midi_file) die("Not a midi-file.");
-	printf("Midi file header signature ok.\n");
 
-	// read the file header size (big endian)
+	printf("%s\n", FILE_HEADER);
+	printf("Midi file header signature ok.\n");
 	printf("Header info:\n");
-
-	t_4byte file_header_size;
-	fread(&file_header_size, sizeof(t_4byte), 1, file_ptr);
-	file_header_size = reverse_endian_int(file_header_size);
-	printf("\tFile header size: %u\n", file_header_size);
-
-	t_2byte file_format;
-	fread(&file_format, sizeof(file_format), 1, file_ptr);
-	file_format = reverse_endian_short(file_format);
-	if(file_format == 0) {
+	printf("\tFile header size: %u\n", song.header_size);
+	if(song.format == 0) {
 		printf("\tFile format: 0 (single track)\n");
-	} else if(file_format == 1) {
+	} else if(song.format == 1) {
 		printf("\tFile format: 1 (multiple tracks)\n");
-	} else if(file_format == 2) {
+	} else if(song.format == 2) {
 		printf("\tFile format: 2 (independent tracks)\n");
 	} else {
 		die("Ending program, unknown Midi-file format: %u");
 	}
+	printf("\tNumber of tracks: %u\n", song.number_of_tracks);
+	printf("\tDelta time ticks: %u\n", song.division);
+	printf("\tTicks per second: %u\n", ticks_per_second(song.division, 60));
+	printf("\tGrid: %i steps per bar, %i bars per pattern\n", options.steps_per_bar, options.bars);
+
+	for(int track = 0; track < song.number_of_tracks; track++) log_track(&song, track);
+
+	midi_pixel_stats stats;
+	if(midi_pixel_write(&out, &song, filename_in, &options, &stats) < 0) die(stats.error);
+	if(options.dedup) printf("\tPatterns: %i, unique: %i\n", stats.number_of_patterns, stats.number_of_unique);
+	printf("\n\t lowest po index:  %i\n\thighest po index: %i\n\n", stats.lowest_po_index, stats.highest_po_index);
+
+	if(midi_writer_flush(&out) < 0) die("Failed to write output.");
+	midi_writer_free(&out);
+	close(file_write_fd);
+	midi_song_free(&song);
+	die("End of program.");
+	return 0;
+}
 
-	t_2byte number_of_tracks;
-	fread(&number_of_tracks, sizeof(number_of_tracks), 1, file_ptr);
-	number_of_tracks = reverse_endian_short(number_of_tracks);
-	printf("\tNumber of tracks: %u\n", number_of_tracks);
-
-	t_2byte delta_time_ticks;
-	fread(&delta_time_ticks, sizeof(delta_time_ticks), 1, file_ptr);
-	delta_time_ticks = reverse_endian_short(delta_time_ticks);
-	printf("\tDelta time ticks: %u\n", delta_time_ticks);
-
-	printf("\tTicks per second: %u\n", ticks_per_second(delta_time_ticks, 60));
-	
-	fprintf(file_write_ptr, "{\n\t\"info\": \"converted using midi2json by superpanic, https://github.com/superpanic\",\n");
-	fprintf(file_write_ptr, "\t\"name\": \"%s\",\n", filename_in);
-	fprintf(file_write_ptr, "\t\"patterns\": [\n");
-
-	int absolute_track_time = 0;
-	int highest_po_index = 0;
-	int lowest_po_index = 128;
-	int highest_note = 0;
-	int lowest_note = 128;
-
-	// read midi tracks
-	for(int track = 0; track < number_of_tracks; track++) {
-		read_len = 4;
-		t_1byte track_header[read_len + 1];
-		fread(track_header, sizeof(track_header[0]), read_len, file_ptr);
-		bool is_a_midi_track = true;
-		for(int i=0; i<read_len; i++) {
-			//printf("%c", track_header[i]);
-			if(TRACK_HEADER[i] != track_header[i]) {
-				is_a_midi_track = false;
-			}
-		}
-		track_header[read_len] = '\0';
-		
-		if (!is_a_midi_track) die("Could not find midi-track.");
-		if(DEBUG) printf("\tMidi track header signature: %s\n",track_header);
-
-		t_4byte number_of_events;
-		fread(&number_of_events, sizeof(number_of_events), 1, file_ptr);
-		number_of_events = reverse_endian_int(number_of_events);
-		if(DEBUG) printf("\tTrack length: %u\n", number_of_events);
-
-		bool is_first_midi_event = true; // used below for json padding chars before the midi events loop
-		bool is_first_note = true;
-		absolute_track_time = 0;
-
-		// start of json file
-		fprintf(file_write_ptr, "\t\t{");
-		fprintf(file_write_ptr, "\n\t\t\t\"track number\":%u,\n", track);
-
-		int step = 0;
-
-		// ### TRACK 0 IS SPECIAL, AND CONTAINS GLOBAL SETUP INFO! ###
-		if(track==0) fprintf(file_write_ptr, "\t\t\t\"className\": \"%s\",\n", "SETUP");
-		// event loop:
-		for(int event = 0; event < number_of_events; event++) {
-			// reading delta time	
-			t_1byte delta_time_buffer[DELTA_TIME_MAX_BYTES];
-			t_1byte delta_time_byte=0xFF;
-			int byte_counter = 0;
-			while(delta_time_byte>=0x80) {
-				if( fread(&delta_time_byte, sizeof(delta_time_byte), 1, file_ptr) == EOF ) die("Reached end of file.");
-				if( byte_counter >= DELTA_TIME_MAX_BYTES ) die("Delta time byte count read exceeds limit.");
-				delta_time_buffer[byte_counter] = delta_time_byte;
-				byte_counter++;
+// checks and logs the meta events of a track
+void log_track(const midi_song *song, int track) {
+	const midi_song_track *t = &song->tracks[track];
+	if(DEBUG) printf("\tMidi track header signature: %s\n", TRACK_HEADER);
+	if(DEBUG) printf("\tTrack length: %zu\n", t->length);
+
+	const midi_song_payload *meta = song->meta + t->first_meta;
+	for(int event = 0; event < t->number_of_events; event++) {
+		size_t e = t->first_event + event;
+		int command_byte = song->status[e];
+		if(command_byte == META_EVENT) {
+			int meta_event_type = song->data1[e];
+			const t_1byte *meta_data = midi_song_payload_data(song, meta);
+			int meta_data_len = meta->length;
+			int meta_index = meta_event_type < 128 ? META_EVENT_INDEX_ARR[meta_event_type] : -1;
+			if(meta_index < 0) {
+				printf("Unknown meta event found: %i\n", meta_event_type);
+				die("Unknown Midi Meta event type:");
 			}
-			
-			// calculate delta time
-			int delta_time_value = 0;
-			for(int i = 0; i<byte_counter; i++) {
-				int dt = delta_time_buffer[i] & 127; // set msb to 0
-				delta_time_value = delta_time_value << 7; // leave room for 7 bits
-				delta_time_value = delta_time_value + dt; // add new value
+			if(track==TRACK_READ) {
+				printf("\tMeta command found at track: %i, event %i: %s\n", track, event, META_EVENT_NAME_ARR[meta_index]);
+				printf("\tLength: %d\n", META_EVENT_LENGTH_ARR[meta_index]);
 			}
-			
-			// read until command type is found
-			t_1byte command_byte = 0;
-			int jump_byte_counter = 0;
-			while( command_byte < 0x80) {
-				if(fread(&command_byte, sizeof(command_byte), 1, file_ptr) == EOF) die("Reached end of file.");
-				jump_byte_counter++;
-			}
-			if(jump_byte_counter > 1) printf("\tFast forward %u bytes.\n", jump_byte_counter-1);
-			
-			if(command_byte == META_EVENT) {
-				t_1byte meta_event_type;
-				fread(&meta_event_type, sizeof(meta_event_type), 1, file_ptr);
-				bool event_is_unknown_type = true;
-				int meta_event_length = 0;
-				for(int i = 0; i<15; i++) {
-					if(meta_event_type == META_EVENT_TYPE_ARR[i]) {
-						if(track==TRACK_READ) {
-							printf("\tMeta command found at track: %i, event %i: %s\n", track, event, META_EVENT_NAME_ARR[i]);
-							printf("\tLength: %d\n", META_EVENT_LENGTH_ARR[i]);
-						}
-						meta_event_length = META_EVENT_LENGTH_ARR[i];
-						event_is_unknown_type = false;
-						break;
-					}
-				}
-				if(event_is_unknown_type) {
-					printf("Unknown meta event found: %i\n", meta_event_type);
-					die("Unknown Midi Meta event type:");
-				}
-				if(meta_event_type == END_OF_TRACK) {
-					t_1byte jump_data_len_byte;
-					fread(&jump_data_len_byte, sizeof(jump_data_len_byte), 1, file_ptr);
-					if(jump_data_len_byte != 0) die("End of track event has data length > 0. Should be 0. Exiting program.");
-										
-					if(track>0) { // track 0 do not contain notes
-						if(step<MAX_STEPS) fprintf(file_write_ptr, ",\n");
-						while(step<MAX_STEPS) {
-							// nothing on this step
-							if(CLEAN) fprintf(file_write_ptr, "\t\t\t\t{\"on\": 0, \"key\": %i}", EMPTY);
-							else fprintf(file_write_ptr, "\t\t\t\t{\"on\": 0, \"key\": %i, \"step\": \"%i\"}", EMPTY, step+1);
-							if(step<MAX_STEPS-1) fprintf(file_write_ptr, ",\n");
-							step++;
-						}
-					}
-
-					if(is_first_note) { // no notes
-						fprintf(file_write_ptr, "\t\t\t\"steps\":[]\n\t\t},\n");
-						break;
-					} else if(track >= number_of_tracks-1) {
-						fprintf(file_write_ptr, "\n\t\t\t]\n\t\t}\n\t],");
-						fprintf(file_write_ptr, "\n\t\"number of tracks\": %i,", number_of_tracks-1);
-						fprintf(file_write_ptr, "\n\t\"lowest midi note\": %i,", lowest_note);
-						fprintf(file_write_ptr, "\n\t\"highest midi note\": %i,", highest_note);
-						fprintf(file_write_ptr, "\n\t\"lowest po index\": %i,", lowest_po_index);
-						fprintf(file_write_ptr, "\n\t\"highest po index\": %i", highest_po_index);
-						fprintf(file_write_ptr, "\n}");
-						printf("\n\t lowest po index:  %i\n\thighest po index: %i\n\n", lowest_po_index, highest_po_index);
-						goto quit;
-					} else {
-						fprintf(file_write_ptr, "\n\t\t\t]\n\t\t},\n");						
-						break;
-					}
-					
-				}
-				
-				if(meta_event_length == -1) {
-					// undefined length string
-					t_1byte string_length;
-					fread(&string_length, sizeof(string_length), 1, file_ptr);
-					t_1byte string_buffer[string_length+1];
-					fread(string_buffer, sizeof(string_buffer[0]), string_length, file_ptr);
-					string_buffer[string_length] = '\0';
-					if(track==TRACK_READ) printf("\t%s\n", string_buffer);
-					if(meta_event_type == INSTRUMENT_NAME) {
-						fprintf(file_write_ptr, "\t\t\t\"className\": \"%s\",\n", string_buffer);
-					}
-				} else if(meta_event_length == -2) {
-					// variable length
-					t_1byte meta_event_data_len;
-					fread(&meta_event_data_len, sizeof(meta_event_data_len), 1, file_ptr);
-					t_1byte jump_bytes[meta_event_data_len];
-					fread(jump_bytes, sizeof(jump_bytes[0]), meta_event_data_len, file_ptr);
-				} else {
-					t_1byte meta_event_data_len;
-					fread(&meta_event_data_len, sizeof(meta_event_data_len), 1, file_ptr);
-					t_1byte meta_event_value[meta_event_length];
-					fread(meta_event_value, sizeof(meta_event_value[0]), meta_event_length, file_ptr);
-				}
-
-			} else if(command_byte == SYSEX_EVENT) {
-				printf("\tSYSEX EVENT\n\tjumping forward to end of event.\n");
-				t_1byte jump_byte=0;
-				while( jump_byte != SYSEX_EVENT_END ) {
-					if( fread(&jump_byte, sizeof(jump_byte), 1, file_ptr) == EOF ) die("Searched for end of SysEx event, but reached end of file.");
-				}
-
-			} else if(track>0) { // TRACK 0 IS SPECIAL AND SHOULD NOT CONTAIN ANY ACTUAL NOTES
-
-				if(is_first_note) {
-					fprintf(file_write_ptr, "\t\t\t\"steps\":[\n");
-					is_first_note = false;
-				}
-
-				int midi_command = get_high_bits(command_byte);
-				int midi_channel = get_low_bits(command_byte);
-				if(midi_channel>=16) die("Read midi event with channel above limit 16.");
-
-				bool event_is_unknown_type = true;
-				int midi_data_len = 0;
-				//int midi_event_number = 0;
-				for(int i=0; i<7; i++) {
-					if(midi_command == MIDI_EVENT_COMMAND_ARR[i]) {
-						midi_data_len = MIDI_EVENT_LENGTH_ARR[i];
-						//midi_event_number = i;
-						event_is_unknown_type = false;
-					}
-				}
-
-				if(event_is_unknown_type) die("Unknown midi event type.");
-				
-				t_1byte midi_data[midi_data_len];
-				fread(midi_data, sizeof(midi_data[0]), midi_data_len, file_ptr);
-
-				absolute_track_time = absolute_track_time + delta_time_value;
-				if(midi_command == NOTE_ON) {
-					if(!is_first_midi_event) fprintf(file_write_ptr, ",\n");
-					else is_first_midi_event = false;
-					step++;
-					int current_step = absolute_track_time/STEP+1;
-
-					t_1byte key = (unsigned char)midi_data[0];
-
-					if(lowest_note > key) lowest_note = key;
-					if(highest_note < key) highest_note = key;
-
-					int POIndex = midiNoteToPOIndex(key, 0, -1);
-					if(lowest_po_index > POIndex) lowest_po_index = POIndex;
-					if(highest_po_index < POIndex) highest_po_index = POIndex;
-
-					while(step<current_step) {
-						// nothing on this step
-						if(CLEAN) fprintf(file_write_ptr, "\t\t\t\t{\"on\": 0, \"key\": %i},\n", EMPTY);
-						else fprintf(file_write_ptr, "\t\t\t\t{\"on\": 0, \"key\": %i, \"step\": %i},\n", EMPTY, step);
-						step++;
-					}
-
-					// note on!
-					if(CLEAN) fprintf(file_write_ptr, "\t\t\t\t{\"on\": 1, \"key\": %i}", POIndex );
-					else fprintf(file_write_ptr, "\t\t\t\t{\"on\": 1, \"key\": %i, \"step\": %i}", POIndex, current_step);
-					step = current_step;
-				}
-
+			if(meta_event_type == END_OF_TRACK && meta_data_len != 0) die("End of track event has data length > 0. Should be 0. Exiting program.");
+			if(META_EVENT_LENGTH_ARR[meta_index] == -1 && track==TRACK_READ) {
+				// undefined length string
+				printf("\t%.*s\n", (int)strnlen((const char *)meta_data, meta_data_len), meta_data);
 			}
-
-		} // end event for loop
-
-	} // end track for loop
-
-	quit:
-		fclose(file_write_ptr);
-		fclose(file_ptr);
-		die("End of program.");
-		return 0;
-}
-
-unsigned char get_low_bits(unsigned char c) {
-	return c & 0x0F;
-}
-
-unsigned char get_high_bits(unsigned char c) {
-	return c >> 4;
-}
-
-unsigned short reverse_endian_short(unsigned short x) {
-	return (
-		( (x >> 8) & 0x00ff ) | 
-		( (x << 8) & 0xff00 )
-	);
-}
-
-unsigned int reverse_endian_int(unsigned int x) {
-	return (
-		( (x >> 24) & 0x000000ff ) | 
-		( (x >>  8) & 0x0000ff00 ) | 
-		( (x <<  8) & 0x00ff0000 ) | 
-		( (x << 24) & 0xff000000 )
-	);
+			meta++;
+		} else if(MIDI_STATUS_TABLE[command_byte].kind == MIDI_STATUS_SYSEX) {
+			printf("\tSYSEX EVENT\n\tjumping forward to end of event.\n");
+		}
+	}
 }
 
 void die(const char *message) {
@@ -455,28 +160,6 @@ void print_type_lengths() {
 	printf("================\n");
 }
 
-void generate_frequencies(float *mi, int len) {
-	float C1 = 8.1757989156; // first C frequency
-	mi[0] = C1;
-	for (int x = 1; x < len; x++) {
-		mi[x] = mi[x-1] * 1.05946309436; // twelfth root of 2
-	}
-}
-
-unsigned int ticks_per_second(unsigned int ticks_per_beat, unsigned int beats_per_minute) {
-	int ticks_per_minute = beats_per_minute * ticks_per_beat;
-	int ticks_per_second = ticks_per_minute / 60;
-	return ticks_per_second;
-}
-
 int get_16_step(float t) {
 	return 0;
 }
-
-int midiNoteToPOIndex(int midiNote, int baseNote, int adjustBaseNote) {
-	if (baseNote == 0) baseNote = 48+(adjustBaseNote*12);
-	if(midiNote < baseNote) die("Try lowering basenote 12 steps.");
-	int note = midiNote-baseNote, octave = note / 12, scaleNote = note % 12;
-	int LUT[12] = {0, 0, 1, 2, 2, 3, 3, 4, 5, 5, 6, 7};
-	return octave * 8 + LUT[scaleNote];
-}
@@ -0,0 +1,146 @@
+#include <string.h>
+
+#include "midi_common.h"
+#include "midi_bin.h"
+
+static void put_u16(unsigned char *p, unsigned int value) {
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void put_u32(unsigned char *p, unsigned int value) {
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static unsigned int get_u16(const unsigned char *p) {
+	return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(const unsigned char *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_float(unsigned char *p, float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	put_u32(p, bits);
+}
+
+static bool is_channel_event(const midi_song *song, size_t event) {
+	return MIDI_STATUS_TABLE[song->status[event]].kind == MIDI_STATUS_CHANNEL;
+}
+
+int midi_bin_write(midi_writer *w, const midi_song *song, const char *name) {
+	size_t name_length = strlen(name);
+	size_t number_of_records = 0;
+	for(size_t e = 0; e < song->number_of_events; e++) {
+		if(is_channel_event(song, e)) number_of_records++;
+	}
+
+	// everything after the name starts 4 byte aligned
+	size_t directory_offset = (sizeof(midi_bin_header) + name_length + 3) & ~(size_t)3;
+	size_t records_offset = directory_offset + (size_t)song->number_of_tracks * sizeof(midi_bin_track);
+	if(records_offset + number_of_records * sizeof(midi_bin_record) > UINT32_MAX) return -1;
+
+	unsigned char header[sizeof(midi_bin_header)] = { 0 };
+	memcpy(header + offsetof(midi_bin_header, magic), MIDI_BIN_MAGIC, 4);
+	put_u16(header + offsetof(midi_bin_header, version), MIDI_BIN_VERSION);
+	put_u16(header + offsetof(midi_bin_header, header_size), sizeof(midi_bin_header));
+	put_u16(header + offsetof(midi_bin_header, format), song->format);
+	put_u16(header + offsetof(midi_bin_header, division), song->division);
+	put_u32(header + offsetof(midi_bin_header, number_of_tracks), song->number_of_tracks);
+	put_u32(header + offsetof(midi_bin_header, track_size), sizeof(midi_bin_track));
+	put_u32(header + offsetof(midi_bin_header, record_size), sizeof(midi_bin_record));
+	put_u32(header + offsetof(midi_bin_header, name_offset), sizeof(midi_bin_header));
+	put_u32(header + offsetof(midi_bin_header, name_length), name_length);
+	put_u32(header + offsetof(midi_bin_header, directory_offset), directory_offset);
+	put_u32(header + offsetof(midi_bin_header, records_offset), records_offset);
+	put_u32(header + offsetof(midi_bin_header, number_of_records), number_of_records);
+	midi_writer_bytes(w, (const char *)header, sizeof(header));
+	midi_writer_bytes(w, name, name_length);
+	midi_writer_bytes(w, "\0\0\0", directory_offset - sizeof(midi_bin_header) - name_length);
+
+	size_t first_record = 0;
+	for(int t = 0; t < song->number_of_tracks; t++) {
+		const midi_song_track *track = &song->tracks[t];
+		size_t records = 0;
+		for(size_t e = track->first_event; e < track->first_event + track->number_of_events; e++) {
+			if(is_channel_event(song, e)) records++;
+		}
+		unsigned char entry[sizeof(midi_bin_track)] = { 0 };
+		put_u32(entry + offsetof(midi_bin_track, first_record), first_record);
+		put_u32(entry + offsetof(midi_bin_track, number_of_records), records);
+		put_u32(entry + offsetof(midi_bin_track, chunk_length), track->length);
+		midi_writer_bytes(w, (const char *)entry, sizeof(entry));
+		first_record += records;
+	}
+
+	for(size_t e = 0; e < song->number_of_events; e++) {
+		if(!is_channel_event(song, e)) continue;
+		unsigned char record[sizeof(midi_bin_record)];
+		put_u32(record + offsetof(midi_bin_record, tick), song->tick[e]);
+		put_u32(record + offsetof(midi_bin_record, delta), midi_song_delta(song, e));
+		record[offsetof(midi_bin_record, status)] = song->status[e];
+		record[offsetof(midi_bin_record, data1)] = song->data1[e];
+		record[offsetof(midi_bin_record, data2)] = song->data2[e];
+		record[offsetof(midi_bin_record, command)] = MIDI_STATUS_TABLE[song->status[e]].command;
+		put_float(record + offsetof(midi_bin_record, frequency), MIDI_NOTE_FREQUENCY_ARR[song->data1[e] & 0x7F]);
+		midi_writer_bytes(w, (const char *)record, sizeof(record));
+	}
+	return w->failed ? -1 : 0;
+}
+
+int midi_bin_load(midi_bin *bin, const unsigned char *data, size_t size) {
+	// the records are used in place, so the host must be little endian too
+	const uint16_t one = 1;
+	if(*(const unsigned char *)&one != 1) return -1;
+
+	if(size < sizeof(midi_bin_header) || ((uintptr_t)data & 3) != 0) return -1;
+	const midi_bin_header *h = (const midi_bin_header *)data;
+	if(memcmp(h->magic, MIDI_BIN_MAGIC, 4) != 0 || h->version != MIDI_BIN_VERSION) return -1;
+	if(h->header_size < sizeof(midi_bin_header) || h->track_size < sizeof(midi_bin_track) || h->record_size < sizeof(midi_bin_record)) return -1;
+	if((h->track_size & 3) != 0 || (h->record_size & 3) != 0 || (h->directory_offset & 3) != 0 || (h->records_offset & 3) != 0) return -1;
+	if((uint64_t)h->name_offset + h->name_length > size) return -1;
+	if((uint64_t)h->directory_offset + (uint64_t)h->number_of_tracks * h->track_size > size) return -1;
+	if((uint64_t)h->records_offset + (uint64_t)h->number_of_records * h->record_size > size) return -1;
+
+	bin->header = h;
+	bin->name = (const char *)data + h->name_offset;
+	bin->tracks = data + h->directory_offset;
+	bin->records = data + h->records_offset;
+	for(uint32_t t = 0; t < h->number_of_tracks; t++) {
+		const midi_bin_track *track = midi_bin_get_track(bin, t);
+		if((uint64_t)track->first_record + track->number_of_records > h->number_of_records) return -1;
+	}
+	return 0;
+}
+
+long midi_bin_rename(midi_writer *w, const unsigned char *data, size_t size, const char *name) {
+	if(size < sizeof(midi_bin_header) || memcmp(data, MIDI_BIN_MAGIC, 4) != 0) return -1;
+	if(get_u16(data + offsetof(midi_bin_header, version)) != MIDI_BIN_VERSION) return -1;
+	if(get_u16(data + offsetof(midi_bin_header, header_size)) != sizeof(midi_bin_header)) return -1;
+	if(get_u32(data + offsetof(midi_bin_header, name_offset)) != sizeof(midi_bin_header)) return -1;
+	size_t old_name_length = get_u32(data + offsetof(midi_bin_header, name_length));
+	size_t old_directory_offset = get_u32(data + offsetof(midi_bin_header, directory_offset));
+	size_t old_records_offset = get_u32(data + offsetof(midi_bin_header, records_offset));
+	if(old_directory_offset < sizeof(midi_bin_header) + old_name_length || old_directory_offset > size) return -1;
+	if(old_records_offset < old_directory_offset) return -1;
+
+	// the directory and records only move, nothing in them points at a file offset
+	size_t name_length = strlen(name);
+	size_t directory_offset = (sizeof(midi_bin_header) + name_length + 3) & ~(size_t)3;
+	size_t records_offset = old_records_offset - old_directory_offset + directory_offset;
+	if(records_offset > UINT32_MAX) return -1;
+	unsigned char header[sizeof(midi_bin_header)];
+	memcpy(header, data, sizeof(header));
+	put_u32(header + offsetof(midi_bin_header, name_length), name_length);
+	put_u32(header + offsetof(midi_bin_header, directory_offset), directory_offset);
+	put_u32(header + offsetof(midi_bin_header, records_offset), records_offset);
+	midi_writer_bytes(w, (const char *)header, sizeof(header));
+	midi_writer_bytes(w, name, name_length);
+	midi_writer_bytes(w, "\0\0\0", directory_offset - sizeof(midi_bin_header) - name_length);
+	return old_directory_offset;
+}
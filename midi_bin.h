@@ -0,0 +1,85 @@
+#ifndef MIDI_BIN_H
+#define MIDI_BIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "midi_song.h"
+#include "midi_writer.h"
+
+// Binary song layout written by midi2json --format=bin. All fields are
+// little endian and naturally aligned, so on a little endian machine the
+// file can be mmap'ed and indexed in place:
+//
+//   midi_bin_header                       at 0
+//   source file name (name_length bytes)  at name_offset
+//   midi_bin_track[number_of_tracks]      at directory_offset
+//   midi_bin_record[number_of_records]    at records_offset
+//
+// Records hold the channel events (the ones the json lists as notes),
+// grouped by track in file order. A reader must reject a version it does
+// not know and must use the stored entry sizes as strides, so later
+// versions can append fields.
+
+#define MIDI_BIN_MAGIC "M2JB"
+#define MIDI_BIN_VERSION 1
+
+typedef struct {
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	uint16_t format;              // midi file format 0, 1 or 2
+	uint16_t division;            // ticks per quarter note
+	uint32_t number_of_tracks;
+	uint32_t track_size;          // sizeof(midi_bin_track)
+	uint32_t record_size;         // sizeof(midi_bin_record)
+	uint32_t name_offset;
+	uint32_t name_length;
+	uint32_t directory_offset;
+	uint32_t records_offset;
+	uint32_t number_of_records;
+} midi_bin_header;
+
+typedef struct {
+	uint32_t first_record;
+	uint32_t number_of_records;
+	uint32_t chunk_length;        // MTrk chunk length in the midi file
+	uint32_t reserved;
+} midi_bin_track;
+
+typedef struct {
+	uint32_t tick;                // absolute ticks since the track start
+	uint32_t delta;               // ticks since the previous event of the track, as in the json
+	uint8_t status;               // command and channel
+	uint8_t data1;                // note, controller, program ...
+	uint8_t data2;                // velocity, value ..., 0 if the command has one data byte
+	uint8_t command;              // index into MIDI_EVENT_NAME_ARR
+	float frequency;              // MIDI_NOTE_FREQUENCY_ARR[data1]
+} midi_bin_record;
+
+// a validated view of a binary song held in memory
+typedef struct {
+	const midi_bin_header *header;
+	const char *name;
+	const unsigned char *tracks;
+	const unsigned char *records;
+} midi_bin;
+
+int midi_bin_write(midi_writer *w, const midi_song *song, const char *name);
+// writes the start of the binary song data to w with name in place of its
+// source file name. data needs to hold the song up to its track directory.
+// Returns the offset in data where the rest follows unchanged, or -1 if
+// data does not start a binary song this version wrote
+long midi_bin_rename(midi_writer *w, const unsigned char *data, size_t size, const char *name);
+// 0 if data holds a binary song this reader understands, -1 otherwise
+int midi_bin_load(midi_bin *bin, const unsigned char *data, size_t size);
+
+static inline const midi_bin_track *midi_bin_get_track(const midi_bin *bin, uint32_t track) {
+	return (const midi_bin_track *)(bin->tracks + (size_t)track * bin->header->track_size);
+}
+
+static inline const midi_bin_record *midi_bin_get_record(const midi_bin *bin, uint32_t record) {
+	return (const midi_bin_record *)(bin->records + (size_t)record * bin->header->record_size);
+}
+
+#endif
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "midi_common.h"
+#include "midi_cache.h"
+
+enum {
+	ENTRY_PATH_MAX = 4096
+};
+
+// what eviction knows about an entry
+typedef struct {
+	char *path;
+	off_t size;
+	long long mtime;         // nanoseconds
+} cache_entry;
+
+static int fail(midi_cache *c, midi_error error) {
+	c->error_code = error;
+	c->error = midi_error_string(error);
+	return -1;
+}
+
+static void entry_path(const midi_cache *c, unsigned long long key, char *path) {
+	snprintf(path, ENTRY_PATH_MAX, "%s/%02llx/%016llx", c->dir, key >> 56, key);
+}
+
+int midi_cache_open(midi_cache *c, const char *dir, unsigned long long max_bytes) {
+	memset(c, 0, sizeof(*c));
+	pthread_mutex_init(&c->lock, NULL);
+	c->max_bytes = max_bytes;
+	c->dir = strdup(dir);
+	if(c->dir == NULL) return fail(c, MIDI_ERROR_OUT_OF_MEMORY);
+	if(mkdir(dir, 0777) < 0 && errno != EEXIST) return fail(c, MIDI_ERROR_WRITE_FAILED);
+	errno = 0;
+	c->error = midi_error_string(MIDI_OK);
+	return 0;
+}
+
+unsigned long long midi_cache_key(const void *data, size_t size, const char *options) {
+	return midi_hash(options, strlen(options) + 1, midi_hash(data, size, MIDI_HASH_SEED));
+}
+
+static int write_all(int fd, const char *data, size_t size) {
+	while(size > 0) {
+		ssize_t n = write(fd, data, size);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return -1;
+		data += n;
+		size -= n;
+	}
+	return 0;
+}
+
+// copies from, starting at offset, to the end of to, in the kernel where it can
+// (and shares the blocks on file systems that reflink)
+static int copy_file(int from, off_t offset, int to) {
+	loff_t pos = offset;
+	for(;;) {
+		ssize_t n = copy_file_range(from, &pos, to, NULL, 1 << 30, 0);
+		if(n == 0) return 0;
+		if(n > 0) continue;
+		if(errno == EINTR) continue;
+		if(errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP) return -1;
+		break;
+	}
+	char buffer[1 << 16];
+	for(;;) {
+		ssize_t n = pread(from, buffer, sizeof(buffer), pos);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return (int)n;
+		if(write_all(to, buffer, n) < 0) return -1;
+		pos += n;
+	}
+}
+
+// from into to, the start of it through splice. Returns -1 if anything failed
+static int splice_file(int from, int to, midi_cache_splice splice, void *user) {
+	if(splice == NULL) return copy_file(from, 0, to);
+	unsigned char start[MIDI_CACHE_HEAD_SIZE];
+	ssize_t size = pread(from, start, sizeof(start), 0);
+	midi_writer head;
+	if(size < 0 || midi_writer_init(&head, -1) < 0) return -1;
+	long skip = splice(user, start, size, &head);
+	int result = skip < 0 || head.failed || write_all(to, head.data, head.len) < 0 ? -1 : copy_file(from, skip, to);
+	midi_writer_free(&head);
+	return result;
+}
+
+static void count(midi_cache *c, unsigned long long *counter, unsigned long long amount) {
+	pthread_mutex_lock(&c->lock);
+	*counter += amount;
+	pthread_mutex_unlock(&c->lock);
+}
+
+int midi_cache_fetch(midi_cache *c, unsigned long long key, const char *filename_out, midi_cache_splice splice, void *user) {
+	char path[ENTRY_PATH_MAX];
+	entry_path(c, key, path);
+	int hit = 0;
+	int from = open(path, O_RDONLY);
+	if(from >= 0) {
+		int to = open(filename_out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		hit = to >= 0 && splice_file(from, to, splice, user) == 0;
+		if(to >= 0) close(to);
+		close(from);
+	}
+	// the entry was used just now, for the LRU order
+	if(hit) utimensat(AT_FDCWD, path, NULL, 0);
+	count(c, hit ? &c->hits : &c->misses, 1);
+	errno = 0;
+	return hit;
+}
+
+int midi_cache_store(midi_cache *c, unsigned long long key, const char *filename_out, midi_cache_splice splice, void *user) {
+	char path[ENTRY_PATH_MAX];
+	entry_path(c, key, path);
+	char *slash = strrchr(path, '/');
+	*slash = '\0';
+	if(mkdir(path, 0777) < 0 && errno != EEXIST) return fail(c, MIDI_ERROR_WRITE_FAILED);
+	*slash = '/';
+
+	// written next to the entry and renamed, so no reader ever sees half of it
+	char temp[ENTRY_PATH_MAX + 16];
+	snprintf(temp, sizeof(temp), "%.*s/.tmpXXXXXX", (int)(slash - path), path);
+	int result = -1;
+	struct stat st;
+	int to = mkstemp(temp);
+	int from = to >= 0 ? open(filename_out, O_RDONLY) : -1;
+	if(from >= 0) result = splice_file(from, to, splice, user);
+	if(from >= 0) close(from);
+	if(to >= 0) close(to);
+	if(result == 0) result = rename(temp, path);
+	if(result < 0) {
+		if(to >= 0) unlink(temp);
+		errno = 0;
+		return fail(c, MIDI_ERROR_WRITE_FAILED);
+	}
+	if(stat(path, &st) == 0) count(c, &c->stored_bytes, st.st_size);
+	return 0;
+}
+
+static int compare_entry_age(const void *a, const void *b) {
+	long long age_a = ((const cache_entry *)a)->mtime, age_b = ((const cache_entry *)b)->mtime;
+	return age_a < age_b ? -1 : age_a > age_b ? 1 : 0;
+}
+
+// removes the least recently used entries until the cache is under 90% of
+// max_bytes, returns the size that is left
+static unsigned long long evict(midi_cache *c) {
+	cache_entry *entries = NULL;
+	size_t number_of_entries = 0, capacity = 0;
+	unsigned long long total = 0;
+	DIR *top = opendir(c->dir);
+	struct dirent *sub;
+	while(top != NULL && (sub = readdir(top)) != NULL) {
+		if(sub->d_name[0] == '.' || strlen(sub->d_name) != 2) continue;
+		char dir[ENTRY_PATH_MAX];
+		snprintf(dir, sizeof(dir), "%s/%s", c->dir, sub->d_name);
+		DIR *d = opendir(dir);
+		struct dirent *file;
+		while(d != NULL && (file = readdir(d)) != NULL) {
+			if(file->d_name[0] == '.') continue;
+			char path[ENTRY_PATH_MAX + 256];
+			snprintf(path, sizeof(path), "%s/%s", dir, file->d_name);
+			struct stat st;
+			if(stat(path, &st) < 0) continue;
+			if(number_of_entries == capacity) {
+				capacity = capacity > 0 ? capacity * 2 : 1024;
+				cache_entry *grown = realloc(entries, capacity * sizeof(cache_entry));
+				if(grown == NULL) break;
+				entries = grown;
+			}
+			char *copy = strdup(path);
+			if(copy == NULL) break;
+			entries[number_of_entries++] = (cache_entry){ copy, st.st_size, st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec };
+			total += st.st_size;
+		}
+		if(d != NULL) closedir(d);
+	}
+	if(top != NULL) closedir(top);
+
+	qsort(entries, number_of_entries, sizeof(cache_entry), compare_entry_age);
+	unsigned long long target = c->max_bytes / 10 * 9;
+	for(size_t i = 0; i < number_of_entries; i++) {
+		if(total > target && unlink(entries[i].path) == 0) total -= entries[i].size;
+		free(entries[i].path);
+	}
+	free(entries);
+	errno = 0;
+	return total;
+}
+
+int midi_cache_close(midi_cache *c) {
+	int result = c->error_code == MIDI_OK ? 0 : -1;
+	char path[ENTRY_PATH_MAX];
+	snprintf(path, sizeof(path), "%s/stats", c->dir);
+	int fd = open(path, O_RDWR | O_CREAT, 0666);
+	if(fd >= 0 && flock(fd, LOCK_EX) == 0) {
+		// other processes add theirs under the same lock
+		char text[128] = { 0 };
+		ssize_t n = pread(fd, text, sizeof(text) - 1, 0);
+		if(n < 0 || sscanf(text, "hits %llu misses %llu bytes %llu", &c->total_hits, &c->total_misses, &c->total_bytes) != 3) {
+			c->total_hits = c->total_misses = c->total_bytes = 0;
+		}
+		c->total_hits += c->hits;
+		c->total_misses += c->misses;
+		c->total_bytes += c->stored_bytes;
+		if(c->max_bytes > 0 && c->total_bytes > c->max_bytes) c->total_bytes = evict(c);
+		int len = snprintf(text, sizeof(text), "hits %llu misses %llu bytes %llu\n", c->total_hits, c->total_misses, c->total_bytes);
+		if(ftruncate(fd, 0) < 0 || pwrite(fd, text, len, 0) != len) result = fail(c, MIDI_ERROR_WRITE_FAILED);
+		flock(fd, LOCK_UN);
+	} else {
+		result = fail(c, MIDI_ERROR_WRITE_FAILED);
+	}
+	if(fd >= 0) close(fd);
+	pthread_mutex_destroy(&c->lock);
+	free(c->dir);
+	c->dir = NULL;
+	errno = 0;
+	return result;
+}
@@ -0,0 +1,63 @@
+#ifndef MIDI_CACHE_H
+#define MIDI_CACHE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "midi_common.h"
+#include "midi_writer.h"
+
+#define MIDI_CACHE_HEAD_SIZE 8192
+
+// Content addressed cache of converted outputs. An entry is keyed on the
+// midi_hash of the input bytes and of the options, and stored as
+// dir/xx/xxxxxxxxxxxxxxxx. Outputs that name their input are stored without
+// the name, so the same song in different places shares one entry: a splice
+// takes it out when storing and puts the name of the output in when
+// fetching, only the first bytes change. A hit writes the output without
+// decoding anything, the bulk is copied by the kernel. Hits refresh the
+// mtime of the entry; when the cache grows beyond max_bytes the least
+// recently used entries are removed until it is back under 90% of it. The hit and miss counters and
+// the size are kept in dir/stats, shared by all processes using the cache.
+
+typedef struct {
+	char *dir;
+	unsigned long long max_bytes;
+
+	// this process, added to dir/stats by midi_cache_close
+	pthread_mutex_t lock;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long stored_bytes;
+
+	// dir/stats after midi_cache_close
+	unsigned long long total_hits;
+	unsigned long long total_misses;
+	unsigned long long total_bytes;
+
+	midi_error error_code;
+	const char *error;       // midi_error_string(error_code)
+} midi_cache;
+
+// creates dir when missing. Returns 0, or -1 with c->error_code set
+int midi_cache_open(midi_cache *c, const char *dir, unsigned long long max_bytes);
+// merges the counters into dir/stats and evicts, returns -1 if that failed
+int midi_cache_close(midi_cache *c);
+
+// key of an input: its bytes, then the options as one string
+unsigned long long midi_cache_key(const void *data, size_t size, const char *options);
+
+// makes the start of one file from the start of another. start holds the
+// first MIDI_CACHE_HEAD_SIZE bytes (fewer for a smaller file); the splice
+// appends what the new file starts with to out and returns how many bytes of
+// start that replaces, the rest is copied as it is. -1 if it can't
+typedef long (*midi_cache_splice)(void *user, const unsigned char *start, size_t size, midi_writer *out);
+
+// puts the entry for key in filename_out, through splice when it is not NULL.
+// Returns 1 on a hit, 0 on a miss
+int midi_cache_fetch(midi_cache *c, unsigned long long key, const char *filename_out, midi_cache_splice splice, void *user);
+// stores the finished output filename_out as the entry for key, through splice
+// when it is not NULL. Returns -1 if it could not
+int midi_cache_store(midi_cache *c, unsigned long long key, const char *filename_out, midi_cache_splice splice, void *user);
+
+#endif
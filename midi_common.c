@@ -0,0 +1,160 @@
+#include "midi_common.h"
+
+const int META_EVENT      = 0xFF;
+const int SYSEX_EVENT     = 0xF0;
+const int SYSEX_EVENT_END = 0xF7;
+const int END_OF_TRACK    = 0x2F;
+const int SET_TEMPO       = 0x51;
+const int NOTE_ON         = 0x9;
+const int NOTE_OFF        = 0x8;
+
+const char *FILE_HEADER = "MThd";
+const char *TRACK_HEADER = "MTrk";
+
+const int DELTA_TIME_MAX_BYTES = 4;
+
+const int MIDI_EVENT_COMMAND_ARR[7] = {
+	0x8, 0x9, 0xA, 0xB, 0xC, 0xD, 0xE
+};
+
+const char MIDI_EVENT_NAME_ARR[7][19] = {
+	"Note OFF",
+	"Note ON",
+	"Note Aftertouch",
+	"Controller",
+	"Program Change",
+	"Channel Aftertouch",
+	"Pitch Bend"
+};
+
+const char MIDI_EVENT_LENGTH_ARR[7] = {
+	2, 2, 2, 2, 1, 1, 2
+};
+
+// C1 = 8.1757989156 Hz, times the twelfth root of 2 per note. The values are
+// accumulated in float, note by note, like the old generate_frequencies() did,
+// so the printed frequencies stay exactly what they always were.
+const float MIDI_NOTE_FREQUENCY_ARR[128] = {
+	8.17579937, 8.66195774, 9.17702484, 9.72271919, 10.3008623, 10.9133835,
+	11.5623274, 12.2498589, 12.9782734, 13.7500019, 14.5676193, 15.4338551,
+	16.3516006, 17.3239174, 18.3540516, 19.4454403, 20.6017265, 21.8267689,
+	23.1246567, 24.4997196, 25.9565487, 27.5000057, 29.1352406, 30.867712,
+	32.7032013, 34.6478348, 36.7081032, 38.8908806, 41.2034531, 43.6535378,
+	46.2493134, 48.9994392, 51.9130974, 55.0000114, 58.2704811, 61.735424,
+	65.4064026, 69.2956696, 73.4162064, 77.7817612, 82.4069061, 87.3070755,
+	92.4986267, 97.9988785, 103.826195, 110.000023, 116.540962, 123.470848,
+	130.812805, 138.591339, 146.832413, 155.563522, 164.813812, 174.614151,
+	184.997253, 195.997757, 207.65239, 220.000046, 233.081924, 246.941696,
+	261.62561, 277.182678, 293.664825, 311.127045, 329.627625, 349.228302,
+	369.994507, 391.995514, 415.304779, 440.000092, 466.163849, 493.883392,
+	523.251221, 554.365356, 587.329651, 622.254089, 659.255249, 698.456604,
+	739.989014, 783.991028, 830.609558, 880.000183, 932.327698, 987.766785,
+	1046.50244, 1108.73071, 1174.6593, 1244.50818, 1318.5105, 1396.91321,
+	1479.97803, 1567.98206, 1661.21912, 1760.00037, 1864.6554, 1975.53357,
+	2093.00488, 2217.46143, 2349.3186, 2489.01636, 2637.021, 2793.82642,
+	2959.95605, 3135.96411, 3322.43823, 3520.00073, 3729.31079, 3951.06714,
+	4186.00977, 4434.92285, 4698.63721, 4978.03271, 5274.04199, 5587.65283,
+	5919.91211, 6271.92822, 6644.87646, 7040.00146, 7458.62158, 7902.13428,
+	8372.01953, 8869.8457, 9397.27441, 9956.06543, 10548.084, 11175.3057,
+	11839.8242, 12543.8564
+};
+
+#define CHANNEL_STATUS(command, length) { MIDI_STATUS_CHANNEL, length, command }
+
+const midi_status_entry MIDI_STATUS_TABLE[256] = {
+	[0x80 ... 0x8F] = CHANNEL_STATUS(0, 2),
+	[0x90 ... 0x9F] = CHANNEL_STATUS(1, 2),
+	[0xA0 ... 0xAF] = CHANNEL_STATUS(2, 2),
+	[0xB0 ... 0xBF] = CHANNEL_STATUS(3, 2),
+	[0xC0 ... 0xCF] = CHANNEL_STATUS(4, 1),
+	[0xD0 ... 0xDF] = CHANNEL_STATUS(5, 1),
+	[0xE0 ... 0xEF] = CHANNEL_STATUS(6, 2),
+	[0xF0] = { MIDI_STATUS_SYSEX, 0, 0 },
+	[0xF7] = { MIDI_STATUS_SYSEX, 0, 0 },    // escape, skipped by its length like F0
+	[0xFF] = { MIDI_STATUS_META, 0, 0 }
+};
+
+const int META_EVENT_TYPE_ARR[15] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 
+	0x05, 0x06, 0x07, 0x20, 0x2F, 
+	0x51, 0x54, 0x58, 0x59, 0x7F
+};
+
+const int META_EVENT_LENGTH_ARR[15] = {
+	 2, -1, -1, -1, -1,
+	-1, -1, -1,  1,  0,
+	 3,  5,  4,  2, -2
+}; // -1 == string, -2 == variable length
+
+const char META_EVENT_NAME_ARR[15][20] = {
+	"Sequence Number",
+	"Text Event",
+	"Copyright Notice",
+	"Sequence/Track Name",
+	"Instrument Name",
+
+	"Lyrics",
+	"Marker",
+	"Cue Point",
+	"Midi Channel Prefix",
+	"End of Track",
+
+	"Set tempo",
+	"SMPTE Offset",
+	"Time Signature",
+	"Key Signature",
+	"Sequencer Specific"
+};
+
+const char MIDI_ERROR_STRING_ARR[16][46] = {
+	"No error.",
+	"File not found.",
+	"Not a midi-file.",
+	"Midi file header is too short.",
+	"Reached end of file.",
+	"Could not find midi-track.",
+	"Track chunk ended in the middle of an event.",
+	"Delta time byte count read exceeds limit.",
+	"Meta or sysex event length exceeds limit.",
+	"Unknown midi event type.",
+	"Out of memory.",
+	"Stopped by callback.",
+	"Index is invalid or does not match the file.",
+	"Note is below the lowest key of the pattern.",
+	"Failed to write output.",
+	"Invalid option."
+};
+
+const char *midi_error_string(midi_error error) {
+	if(error < MIDI_OK || error > MIDI_ERROR_BAD_OPTION) return "Unknown error.";
+	return MIDI_ERROR_STRING_ARR[error];
+}
+
+const signed char META_EVENT_INDEX_ARR[128] = {
+	[0 ... 127] = -1,
+	[0x00] = 0, [0x01] = 1, [0x02] = 2, [0x03] = 3, [0x04] = 4,
+	[0x05] = 5, [0x06] = 6, [0x07] = 7, [0x20] = 8, [0x2F] = 9,
+	[0x51] = 10, [0x54] = 11, [0x58] = 12, [0x59] = 13, [0x7F] = 14
+};
+
+unsigned char get_low_bits(unsigned char c) {
+	return c & 0x0F;
+}
+
+unsigned char get_high_bits(unsigned char c) {
+	return c >> 4;
+}
+
+unsigned int ticks_per_second(unsigned int ticks_per_beat, unsigned int beats_per_minute) {
+	int ticks_per_minute = beats_per_minute * ticks_per_beat;
+	int ticks_per_second = ticks_per_minute / 60;
+	return ticks_per_second;
+}
+
+unsigned long long midi_hash(const void *data, size_t len, unsigned long long hash) {
+	const unsigned char *p = data;
+	for(size_t i = 0; i < len; i++) {
+		hash = (hash ^ p[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
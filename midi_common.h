@@ -0,0 +1,84 @@
+#ifndef MIDI_COMMON_H
+#define MIDI_COMMON_H
+
+#include <stddef.h>
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+typedef unsigned char  t_1byte;
+typedef unsigned short t_2byte;
+typedef unsigned int   t_4byte;
+typedef unsigned long  t_8byte;
+
+extern const int META_EVENT;
+extern const int SYSEX_EVENT;
+extern const int SYSEX_EVENT_END;
+extern const int END_OF_TRACK;
+extern const int SET_TEMPO;
+extern const int NOTE_ON;
+extern const int NOTE_OFF;
+
+extern const char *FILE_HEADER;
+extern const char *TRACK_HEADER;
+
+extern const int DELTA_TIME_MAX_BYTES;
+
+extern const int MIDI_EVENT_COMMAND_ARR[7];
+extern const char MIDI_EVENT_NAME_ARR[7][19];
+extern const char MIDI_EVENT_LENGTH_ARR[7];
+
+extern const float MIDI_NOTE_FREQUENCY_ARR[128]; // Hz
+
+// what a status byte starts, found with one lookup of the full byte
+typedef enum {
+	MIDI_STATUS_INVALID = 0,   // data bytes and unsupported system messages
+	MIDI_STATUS_CHANNEL,
+	MIDI_STATUS_META,
+	MIDI_STATUS_SYSEX
+} midi_status_kind;
+
+typedef struct {
+	unsigned char kind;        // midi_status_kind
+	unsigned char data_length; // data bytes of a channel event
+	unsigned char command;     // index into the MIDI_EVENT_*_ARR tables
+} midi_status_entry;
+
+extern const midi_status_entry MIDI_STATUS_TABLE[256];
+
+extern const int META_EVENT_TYPE_ARR[15];
+extern const int META_EVENT_LENGTH_ARR[15]; // -1 == string, -2 == variable length
+extern const char META_EVENT_NAME_ARR[15][20];
+extern const signed char META_EVENT_INDEX_ARR[128]; // type -> index into META_EVENT_*_ARR, -1 if unknown
+
+// error codes returned by the library, nothing in it ever exits the process
+typedef enum {
+	MIDI_OK = 0,
+	MIDI_ERROR_FILE_NOT_FOUND,
+	MIDI_ERROR_NOT_MIDI,
+	MIDI_ERROR_HEADER_TOO_SHORT,
+	MIDI_ERROR_END_OF_FILE,
+	MIDI_ERROR_NO_TRACK,
+	MIDI_ERROR_TRACK_TRUNCATED,
+	MIDI_ERROR_DELTA_TIME_TOO_LONG,
+	MIDI_ERROR_LENGTH_TOO_LONG,
+	MIDI_ERROR_UNKNOWN_EVENT,
+	MIDI_ERROR_OUT_OF_MEMORY,
+	MIDI_ERROR_STOPPED,
+	MIDI_ERROR_BAD_INDEX,
+	MIDI_ERROR_NOTE_TOO_LOW,
+	MIDI_ERROR_WRITE_FAILED,
+	MIDI_ERROR_BAD_OPTION
+} midi_error;
+
+const char *midi_error_string(midi_error error);
+
+unsigned int ticks_per_second(unsigned int ticks_per_beat, unsigned int beats_per_minute);
+unsigned char get_low_bits(unsigned char c);
+unsigned char get_high_bits(unsigned char c);
+
+// 64 bit FNV-1a, start with MIDI_HASH_SEED and chain calls to hash pieces in a row
+#define MIDI_HASH_SEED 14695981039346656037ULL
+unsigned long long midi_hash(const void *data, size_t len, unsigned long long hash);
+
+#endif
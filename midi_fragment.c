@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "midi_common.h"
+#include "midi_reader.h"
+#include "midi_fragment.h"
+
+enum {
+	FRAGMENT_PATH_MAX = 4096
+};
+
+static const char MANIFEST_HEADER[] = "midi2json fragments 1\n";
+
+static int fail(midi_fragments *f, midi_error error) {
+	f->error_code = error;
+	f->error = midi_error_string(error);
+	return -1;
+}
+
+static int compare_key(const void *a, const void *b) {
+	unsigned long long key_a = *(const unsigned long long *)a, key_b = *(const unsigned long long *)b;
+	return key_a < key_b ? -1 : key_a > key_b ? 1 : 0;
+}
+
+static bool has_key(const unsigned long long *keys, size_t number_of_keys, unsigned long long key) {
+	return bsearch(&key, keys, number_of_keys, sizeof(*keys), compare_key) != NULL;
+}
+
+static int load_manifest(midi_fragments *f) {
+	char path[FRAGMENT_PATH_MAX];
+	snprintf(path, sizeof(path), "%s/manifest", f->dir);
+	midi_reader in;
+	if(midi_reader_open(&in, path) < 0) return 0;
+	const char *data = (const char *)in.data;
+	size_t header_len = strlen(MANIFEST_HEADER);
+	if(in.size < header_len || memcmp(data, MANIFEST_HEADER, header_len) != 0) {
+		// not a manifest this version wrote, nothing in the directory is used
+		midi_reader_close(&in);
+		return 0;
+	}
+	size_t capacity = 0;
+	for(size_t i = header_len; i < in.size; i++) {
+		if(data[i] == '\n') capacity++;
+	}
+	f->keys = malloc((capacity > 0 ? capacity : 1) * sizeof(*f->keys));
+	if(f->keys == NULL) {
+		midi_reader_close(&in);
+		return -1;
+	}
+	for(size_t start = header_len; start < in.size && f->number_of_keys < capacity; ) {
+		const char *line = data + start;
+		const char *end = memchr(line, '\n', in.size - start);
+		if(end == NULL) break;
+		// the key is the first 16 characters of the line
+		if(end - line > 16 && line[16] == ' ') {
+			char hex[17];
+			memcpy(hex, line, 16);
+			hex[16] = '\0';
+			char *after;
+			unsigned long long key = strtoull(hex, &after, 16);
+			if(*after == '\0') f->keys[f->number_of_keys++] = key;
+		}
+		start = end - data + 1;
+	}
+	midi_reader_close(&in);
+	qsort(f->keys, f->number_of_keys, sizeof(*f->keys), compare_key);
+	return 0;
+}
+
+int midi_fragments_open(midi_fragments *f, const char *dir, const char *name) {
+	memset(f, 0, sizeof(*f));
+	if(mkdir(dir, 0777) < 0 && errno != EEXIST) return fail(f, MIDI_ERROR_WRITE_FAILED);
+	size_t len = strlen(dir) + 18;
+	f->dir = malloc(len);
+	if(f->dir == NULL) return fail(f, MIDI_ERROR_OUT_OF_MEMORY);
+	snprintf(f->dir, len, "%s/%016llx", dir, midi_hash(name, strlen(name), MIDI_HASH_SEED));
+	if(mkdir(f->dir, 0777) < 0 && errno != EEXIST) return fail(f, MIDI_ERROR_WRITE_FAILED);
+	if(load_manifest(f) < 0) return fail(f, MIDI_ERROR_OUT_OF_MEMORY);
+	errno = 0;
+	f->error = midi_error_string(MIDI_OK);
+	return 0;
+}
+
+char *midi_fragments_read(const midi_fragments *f, unsigned long long key, size_t *size) {
+	if(!has_key(f->keys, f->number_of_keys, key)) return NULL;
+	char path[FRAGMENT_PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%016llx", f->dir, key);
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) return NULL;
+	struct stat st;
+	char *data = NULL;
+	if(fstat(fd, &st) == 0 && (data = malloc(st.st_size > 0 ? st.st_size : 1)) != NULL) {
+		size_t done = 0;
+		while(done < (size_t)st.st_size) {
+			ssize_t n = read(fd, data + done, st.st_size - done);
+			if(n < 0 && errno == EINTR) continue;
+			if(n <= 0) break;
+			done += n;
+		}
+		if(done < (size_t)st.st_size) {
+			free(data);
+			data = NULL;
+		}
+		*size = done;
+	}
+	close(fd);
+	errno = 0;
+	return data;
+}
+
+static int write_file(const char *dir, const char *path, const char *data, size_t size) {
+	char temp[FRAGMENT_PATH_MAX + 16];
+	snprintf(temp, sizeof(temp), "%s/.tmpXXXXXX", dir);
+	int fd = mkstemp(temp);
+	if(fd < 0) return -1;
+	int result = 0;
+	while(size > 0) {
+		ssize_t n = write(fd, data, size);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) {
+			result = -1;
+			break;
+		}
+		data += n;
+		size -= n;
+	}
+	if(close(fd) < 0) result = -1;
+	if(result == 0) result = rename(temp, path);
+	if(result < 0) unlink(temp);
+	errno = 0;
+	return result;
+}
+
+int midi_fragments_write(midi_fragments *f, unsigned long long key, const char *data, size_t size) {
+	char path[FRAGMENT_PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%016llx", f->dir, key);
+	return write_file(f->dir, path, data, size);
+}
+
+int midi_fragments_close(midi_fragments *f, const unsigned long long *keys, int number_of_tracks) {
+	int result = f->error_code == MIDI_OK ? 0 : -1;
+	char *manifest = malloc(strlen(MANIFEST_HEADER) + (size_t)number_of_tracks * 24 + 1);
+	unsigned long long *sorted = malloc((number_of_tracks > 0 ? number_of_tracks : 1) * sizeof(*sorted));
+	if(manifest == NULL || sorted == NULL) {
+		result = fail(f, MIDI_ERROR_OUT_OF_MEMORY);
+	} else if(f->dir != NULL) {
+		char *p = manifest + sprintf(manifest, "%s", MANIFEST_HEADER);
+		for(int track = 0; track < number_of_tracks; track++) {
+			p += sprintf(p, "%016llx %d\n", keys[track], track + 1);
+			sorted[track] = keys[track];
+		}
+		char path[FRAGMENT_PATH_MAX];
+		snprintf(path, sizeof(path), "%s/manifest", f->dir);
+		if(write_file(f->dir, path, manifest, p - manifest) < 0) result = fail(f, MIDI_ERROR_WRITE_FAILED);
+
+		// the fragments of tracks that changed since, only once the new manifest is in place
+		qsort(sorted, number_of_tracks, sizeof(*sorted), compare_key);
+		DIR *d = result == 0 ? opendir(f->dir) : NULL;
+		struct dirent *file;
+		while(d != NULL && (file = readdir(d)) != NULL) {
+			if(strlen(file->d_name) != 16) continue;
+			char *end;
+			unsigned long long key = strtoull(file->d_name, &end, 16);
+			if(*end != '\0' || has_key(sorted, number_of_tracks, key)) continue;
+			snprintf(path, sizeof(path), "%s/%s", f->dir, file->d_name);
+			unlink(path);
+		}
+		if(d != NULL) closedir(d);
+	}
+	free(manifest);
+	free(sorted);
+	free(f->keys);
+	free(f->dir);
+	f->keys = NULL;
+	f->dir = NULL;
+	f->number_of_keys = 0;
+	errno = 0;
+	return result;
+}
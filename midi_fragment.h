@@ -0,0 +1,42 @@
+#ifndef MIDI_FRAGMENT_H
+#define MIDI_FRAGMENT_H
+
+#include <stddef.h>
+
+#include "midi_common.h"
+
+// Per track pieces of one converted output, so a file where only some
+// tracks changed is put together again from the pieces of the tracks that
+// did not. Every output has its own directory, dir/<midi_hash of its name>,
+// holding one file per fragment, named after its key (16 hex digits), and a
+// manifest listing the keys of the last complete run:
+//
+//   midi2json fragments 1
+//   key <space> track
+//
+// Only fragments in the manifest are used. Fragments are written to a
+// temporary file and renamed, the manifest last, so a run that stops half
+// way leaves the previous one usable.
+
+typedef struct {
+	char *dir;               // of this output
+	unsigned long long *keys; // from the manifest, sorted
+	size_t number_of_keys;
+
+	midi_error error_code;
+	const char *error;       // midi_error_string(error_code)
+} midi_fragments;
+
+// loads the manifest of the fragments of name in dir, creating the directories when missing.
+// Returns 0, or -1 with f->error_code set
+int midi_fragments_open(midi_fragments *f, const char *dir, const char *name);
+// writes the manifest of this run, the keys of every track in order, and
+// removes the fragments it no longer lists. Returns -1 if that failed
+int midi_fragments_close(midi_fragments *f, const unsigned long long *keys, int number_of_tracks);
+
+// the fragment for key from the last run, in a buffer the caller frees. NULL when there is none
+char *midi_fragments_read(const midi_fragments *f, unsigned long long key, size_t *size);
+// safe to call from several threads, returns -1 when the fragment could not be written
+int midi_fragments_write(midi_fragments *f, unsigned long long key, const char *data, size_t size);
+
+#endif
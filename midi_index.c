@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_common.h"
+#include "midi_reader.h"
+#include "midi_parallel.h"
+#include "midi_index.h"
+
+// entry sizes in the sidecar file
+enum {
+	INDEX_HEADER_SIZE = 32,
+	INDEX_TRACK_SIZE = 16,
+	INDEX_CHECKPOINT_SIZE = 16,
+	CHECK_WINDOW = 32        // bytes hashed on each side of a checkpoint
+};
+
+// checkpoints of one track, collected on their own and concatenated afterwards
+typedef struct {
+	midi_parser parser;
+	unsigned int interval;
+	midi_parser_position *checkpoints;
+	size_t number_of_checkpoints;
+	size_t capacity;
+	midi_error error_code;
+} track_index;
+
+typedef struct {
+	const unsigned char *data;
+	const midi_track_chunk *chunks;
+	track_index *tracks;
+} index_build;
+
+void midi_index_init(midi_index *index) {
+	memset(index, 0, sizeof(*index));
+}
+
+void midi_index_free(midi_index *index) {
+	free(index->tracks);
+	free(index->checkpoints);
+	free(index->window_hashes);
+	midi_index_init(index);
+}
+
+static int fail(midi_index *index, midi_error code) {
+	index->error_code = code;
+	index->error = midi_error_string(code);
+	return -1;
+}
+
+// the MThd chunk and the header of every MTrk chunk, -1 when they are not all inside the file
+static int hash_headers(midi_index *index, const unsigned char *data, size_t size) {
+	if(size < 8) return -1;
+	size_t header_end = 8 + (size_t)(data[4] << 24 | data[5] << 16 | data[6] << 8 | data[7]);
+	if(header_end > size) return -1;
+	unsigned long long hash = midi_hash(data, header_end, MIDI_HASH_SEED);
+	for(int t = 0; t < index->number_of_tracks; t++) {
+		size_t offset = index->tracks[t].chunk_offset;
+		if(offset < 8 || offset + index->tracks[t].chunk_length > size) return -1;
+		hash = midi_hash(data + offset - 8, 8, hash);
+	}
+	index->headers_hash = hash;
+	return 0;
+}
+
+static unsigned int hash_window(const unsigned char *chunk, size_t length, size_t offset) {
+	size_t start = offset > CHECK_WINDOW ? offset - CHECK_WINDOW : 0;
+	size_t end = length - offset > CHECK_WINDOW ? offset + CHECK_WINDOW : length;
+	return (unsigned int)midi_hash(chunk + start, end - start, MIDI_HASH_SEED);
+}
+
+static int add_checkpoint(track_index *t, const midi_parser_position *position) {
+	if(t->number_of_checkpoints == t->capacity) {
+		size_t capacity = t->capacity ? t->capacity * 2 : 64;
+		midi_parser_position *grown = realloc(t->checkpoints, capacity * sizeof(midi_parser_position));
+		if(grown == NULL) return -1;
+		t->checkpoints = grown;
+		t->capacity = capacity;
+	}
+	t->checkpoints[t->number_of_checkpoints++] = *position;
+	return 0;
+}
+
+// parser callback, a checkpoint after the first event that is interval ticks past the last one
+static int index_event(void *user, const midi_event *ev) {
+	track_index *t = user;
+	if(ev->kind != MIDI_EVENT_CHANNEL && ev->kind != MIDI_EVENT_META && ev->kind != MIDI_EVENT_SYSEX) return 0;
+	const midi_parser_position *last = &t->checkpoints[t->number_of_checkpoints - 1];
+	if(ev->tick - last->tick < t->interval) return 0;
+	midi_parser_position position;
+	midi_parser_position_after(&t->parser, &position);
+	if(add_checkpoint(t, &position) < 0) {
+		t->error_code = MIDI_ERROR_OUT_OF_MEMORY;
+		return -1;
+	}
+	return 0;
+}
+
+static void index_track(void *ctx, int track) {
+	index_build *build = ctx;
+	track_index *t = &build->tracks[track];
+	const midi_track_chunk *chunk = &build->chunks[track];
+
+	midi_parser_position start = { 0 };
+	if(add_checkpoint(t, &start) < 0) {
+		t->error_code = MIDI_ERROR_OUT_OF_MEMORY;
+		return;
+	}
+	midi_parser_init_track(&t->parser, track, chunk->length, index_event, t);
+	if(midi_parser_feed(&t->parser, build->data + chunk->offset, chunk->length) < 0 || midi_parser_finish(&t->parser) < 0) {
+		if(t->error_code == MIDI_OK) t->error_code = t->parser.error_code;
+	}
+	midi_parser_free(&t->parser);
+}
+
+int midi_index_build(midi_index *index, const unsigned char *data, size_t size, unsigned int interval) {
+	midi_index_free(index);
+	midi_reader in = { .data = data, .size = size };
+	unsigned int header_size;
+	const unsigned char *file_header = midi_reader_bytes(&in, 4);
+	if(file_header == NULL || memcmp(file_header, FILE_HEADER, 4) != 0) return fail(index, MIDI_ERROR_NOT_MIDI);
+	if(!midi_reader_u32(&in, &header_size) ||
+		!midi_reader_u16(&in, &index->format) ||
+		!midi_reader_u16(&in, &index->number_of_tracks) ||
+		!midi_reader_u16(&in, &index->division)) {
+		return fail(index, MIDI_ERROR_END_OF_FILE);
+	}
+	if(header_size < 6) return fail(index, MIDI_ERROR_HEADER_TOO_SHORT);
+	if(interval == 0) interval = index->division & 0x8000 ? 7680 : 16 * (unsigned int)index->division;
+	index->interval = interval > 0 ? interval : 1;
+	index->midi_size = size;
+
+	int number_of_tracks = index->number_of_tracks;
+	in.pos = 8 + header_size;
+	midi_track_chunk *chunks = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(midi_track_chunk));
+	track_index *tracks = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(track_index));
+	index->tracks = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(midi_index_track));
+	if(chunks == NULL || tracks == NULL || index->tracks == NULL) {
+		free(chunks);
+		free(tracks);
+		return fail(index, MIDI_ERROR_OUT_OF_MEMORY);
+	}
+
+	int result = 0;
+	if(midi_reader_find_tracks(&in, chunks, number_of_tracks) < number_of_tracks) {
+		result = fail(index, MIDI_ERROR_NO_TRACK);
+	} else {
+		for(int t = 0; t < number_of_tracks; t++) tracks[t].interval = index->interval;
+		index_build build = { .data = data, .chunks = chunks, .tracks = tracks };
+		midi_parallel_for(number_of_tracks, 0, index_track, &build);
+
+		size_t total = 0;
+		for(int t = 0; t < number_of_tracks && result == 0; t++) {
+			if(tracks[t].error_code != MIDI_OK) result = fail(index, tracks[t].error_code);
+			total += tracks[t].number_of_checkpoints;
+		}
+		if(result == 0) {
+			index->checkpoints = malloc((total > 0 ? total : 1) * sizeof(midi_parser_position));
+			index->window_hashes = malloc((total > 0 ? total : 1) * sizeof(unsigned int));
+			if(index->checkpoints == NULL || index->window_hashes == NULL) result = fail(index, MIDI_ERROR_OUT_OF_MEMORY);
+		}
+		for(int t = 0; t < number_of_tracks && result == 0; t++) {
+			midi_index_track *track = &index->tracks[t];
+			track->chunk_offset = chunks[t].offset;
+			track->chunk_length = chunks[t].length;
+			track->first_checkpoint = index->number_of_checkpoints;
+			track->number_of_checkpoints = tracks[t].number_of_checkpoints;
+			memcpy(index->checkpoints + index->number_of_checkpoints, tracks[t].checkpoints, tracks[t].number_of_checkpoints * sizeof(midi_parser_position));
+			for(size_t c = 0; c < tracks[t].number_of_checkpoints; c++) {
+				index->window_hashes[index->number_of_checkpoints + c] = hash_window(data + chunks[t].offset, chunks[t].length, tracks[t].checkpoints[c].offset);
+			}
+			index->number_of_checkpoints += tracks[t].number_of_checkpoints;
+		}
+		if(result == 0 && hash_headers(index, data, size) < 0) result = fail(index, MIDI_ERROR_NO_TRACK);
+	}
+
+	for(int t = 0; t < number_of_tracks; t++) free(tracks[t].checkpoints);
+	free(tracks);
+	free(chunks);
+	if(result < 0) {
+		midi_error code = index->error_code;
+		midi_index_free(index);
+		fail(index, code);
+	}
+	return result;
+}
+
+static void put_u16(unsigned char *p, unsigned int value) {
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void put_u32(unsigned char *p, unsigned int value) {
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static unsigned int get_u16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int get_u32(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+int midi_index_write(const midi_index *index, midi_writer *w) {
+	unsigned char header[INDEX_HEADER_SIZE];
+	memcpy(header, MIDI_INDEX_MAGIC, 4);
+	put_u16(header + 4, MIDI_INDEX_VERSION);
+	put_u16(header + 6, index->format);
+	put_u16(header + 8, index->division);
+	put_u16(header + 10, index->number_of_tracks);
+	put_u32(header + 12, index->interval);
+	put_u32(header + 16, index->midi_size);
+	put_u32(header + 20, index->number_of_checkpoints);
+	put_u32(header + 24, (unsigned int)index->headers_hash);
+	put_u32(header + 28, (unsigned int)(index->headers_hash >> 32));
+	midi_writer_bytes(w, (const char *)header, sizeof(header));
+
+	for(int t = 0; t < index->number_of_tracks; t++) {
+		const midi_index_track *track = &index->tracks[t];
+		unsigned char entry[INDEX_TRACK_SIZE];
+		put_u32(entry, track->chunk_offset);
+		put_u32(entry + 4, track->chunk_length);
+		put_u32(entry + 8, track->first_checkpoint);
+		put_u32(entry + 12, track->number_of_checkpoints);
+		midi_writer_bytes(w, (const char *)entry, sizeof(entry));
+	}
+	for(size_t c = 0; c < index->number_of_checkpoints; c++) {
+		const midi_parser_position *checkpoint = &index->checkpoints[c];
+		unsigned char entry[INDEX_CHECKPOINT_SIZE] = { 0 };
+		put_u32(entry, checkpoint->offset);
+		put_u32(entry + 4, checkpoint->tick);
+		entry[8] = checkpoint->running_status;
+		put_u32(entry + 12, index->window_hashes[c]);
+		midi_writer_bytes(w, (const char *)entry, sizeof(entry));
+	}
+	return w->failed ? -1 : 0;
+}
+
+int midi_index_load(midi_index *index, const unsigned char *data, size_t size, const unsigned char *midi_data, size_t midi_size) {
+	midi_index_free(index);
+	if(size < INDEX_HEADER_SIZE || memcmp(data, MIDI_INDEX_MAGIC, 4) != 0 || get_u16(data + 4) != MIDI_INDEX_VERSION) {
+		return fail(index, MIDI_ERROR_BAD_INDEX);
+	}
+	index->format = get_u16(data + 6);
+	index->division = get_u16(data + 8);
+	index->number_of_tracks = get_u16(data + 10);
+	index->interval = get_u32(data + 12);
+	index->midi_size = get_u32(data + 16);
+	index->number_of_checkpoints = get_u32(data + 20);
+	unsigned long long headers_hash = get_u32(data + 24) | (unsigned long long)get_u32(data + 28) << 32;
+	size_t needed = INDEX_HEADER_SIZE + index->number_of_tracks * INDEX_TRACK_SIZE + index->number_of_checkpoints * INDEX_CHECKPOINT_SIZE;
+	if(index->midi_size != midi_size || size < needed) {
+		midi_index_free(index);
+		return fail(index, MIDI_ERROR_BAD_INDEX);
+	}
+
+	index->tracks = calloc(index->number_of_tracks > 0 ? index->number_of_tracks : 1, sizeof(midi_index_track));
+	index->checkpoints = calloc(index->number_of_checkpoints > 0 ? index->number_of_checkpoints : 1, sizeof(midi_parser_position));
+	index->window_hashes = calloc(index->number_of_checkpoints > 0 ? index->number_of_checkpoints : 1, sizeof(unsigned int));
+	if(index->tracks == NULL || index->checkpoints == NULL || index->window_hashes == NULL) {
+		midi_index_free(index);
+		return fail(index, MIDI_ERROR_OUT_OF_MEMORY);
+	}
+	const unsigned char *p = data + INDEX_HEADER_SIZE;
+	for(int t = 0; t < index->number_of_tracks; t++, p += INDEX_TRACK_SIZE) {
+		midi_index_track *track = &index->tracks[t];
+		track->chunk_offset = get_u32(p);
+		track->chunk_length = get_u32(p + 4);
+		track->first_checkpoint = get_u32(p + 8);
+		track->number_of_checkpoints = get_u32(p + 12);
+		// every track needs its start checkpoint, and the chunk has to be inside the file
+		if(track->number_of_checkpoints == 0 ||
+			track->first_checkpoint + track->number_of_checkpoints > index->number_of_checkpoints ||
+			track->chunk_offset + track->chunk_length > midi_size) {
+			midi_index_free(index);
+			return fail(index, MIDI_ERROR_BAD_INDEX);
+		}
+	}
+	for(size_t c = 0; c < index->number_of_checkpoints; c++, p += INDEX_CHECKPOINT_SIZE) {
+		index->checkpoints[c].offset = get_u32(p);
+		index->checkpoints[c].tick = get_u32(p + 4);
+		index->checkpoints[c].running_status = p[8];
+		index->window_hashes[c] = get_u32(p + 12);
+	}
+	// the size rules out most other files, the headers a file with other tracks.
+	// The bytes the decoding starts from are checked by midi_index_check
+	if(hash_headers(index, midi_data, midi_size) < 0 || index->headers_hash != headers_hash) {
+		midi_index_free(index);
+		return fail(index, MIDI_ERROR_BAD_INDEX);
+	}
+	return 0;
+}
+
+const midi_parser_position *midi_index_seek(const midi_index *index, int track, unsigned int tick) {
+	const midi_index_track *t = &index->tracks[track];
+	const midi_parser_position *checkpoints = index->checkpoints + t->first_checkpoint;
+	// binary search for the last checkpoint with a smaller tick, the track start if there is none
+	size_t low = 1, high = t->number_of_checkpoints;
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		if(checkpoints[middle].tick < tick) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return &checkpoints[low - 1];
+}
+
+int midi_index_check(const midi_index *index, const unsigned char *midi_data, int track, const midi_parser_position *checkpoint) {
+	const midi_index_track *t = &index->tracks[track];
+	if(checkpoint->offset > t->chunk_length) return -1;
+	unsigned int hash = hash_window(midi_data + t->chunk_offset, t->chunk_length, checkpoint->offset);
+	return hash == index->window_hashes[checkpoint - index->checkpoints] ? 0 : -1;
+}
@@ -0,0 +1,68 @@
+#ifndef MIDI_INDEX_H
+#define MIDI_INDEX_H
+
+#include <stddef.h>
+
+#include "midi_common.h"
+#include "midi_parser.h"
+#include "midi_writer.h"
+
+// Seek index of a midi file: per track, a parser position every interval
+// ticks, so decoding can start close to any tick instead of at the start
+// of the track. Written as a small sidecar file next to the midi file:
+//
+//   "M2JI", u16 version, u16 format, u16 division, u16 number_of_tracks,
+//   u32 interval, u32 midi file size, u32 number_of_checkpoints,
+//   u64 midi_hash of the MThd chunk and the MTrk chunk headers
+//   per track:      u32 chunk_offset, u32 chunk_length, u32 first_checkpoint, u32 number_of_checkpoints
+//   per checkpoint: u32 offset, u32 tick, u8 running_status, 3 bytes padding,
+//                   u32 hash of the chunk bytes around offset
+//
+// all little endian. Every track starts with a checkpoint at offset 0.
+// Checking an index against its file costs the same for any file size:
+// the headers when it is loaded, the bytes around a checkpoint before
+// decoding starts there.
+
+#define MIDI_INDEX_MAGIC "M2JI"
+#define MIDI_INDEX_VERSION 3
+
+typedef struct {
+	size_t chunk_offset;     // of the MTrk chunk body in the midi file
+	size_t chunk_length;
+	size_t first_checkpoint;
+	size_t number_of_checkpoints;
+} midi_index_track;
+
+typedef struct {
+	unsigned short format;
+	unsigned short number_of_tracks;
+	unsigned short division;
+	unsigned int interval;   // ticks between checkpoints
+	size_t midi_size;        // of the file the index was built from
+	unsigned long long headers_hash; // of its MThd chunk and MTrk headers
+
+	midi_index_track *tracks;
+	midi_parser_position *checkpoints; // sorted by tick within each track
+	unsigned int *window_hashes;       // per checkpoint, of the bytes around it
+	size_t number_of_checkpoints;
+
+	midi_error error_code;
+	const char *error;       // midi_error_string(error_code)
+} midi_index;
+
+void midi_index_init(midi_index *index);
+void midi_index_free(midi_index *index);
+
+// return 0 on success, -1 with index->error_code set
+// interval 0 picks 16 quarter notes
+int midi_index_build(midi_index *index, const unsigned char *data, size_t size, unsigned int interval);
+int midi_index_write(const midi_index *index, midi_writer *w);
+// reads a sidecar, the size and headers of midi_data must match the file it was built from
+int midi_index_load(midi_index *index, const unsigned char *data, size_t size, const unsigned char *midi_data, size_t midi_size);
+
+// last checkpoint of the track before tick, decoding from there reaches every event at tick or later
+const midi_parser_position *midi_index_seek(const midi_index *index, int track, unsigned int tick);
+// 0 if the bytes around a checkpoint of track are still the ones it was made from, -1 otherwise
+int midi_index_check(const midi_index *index, const unsigned char *midi_data, int track, const midi_parser_position *checkpoint);
+
+#endif
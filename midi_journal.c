@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "midi_common.h"
+#include "midi_reader.h"
+#include "midi_journal.h"
+
+const char JOURNAL_STATUS_ARR[2][7] = { "ok", "failed" };
+
+static int fail(midi_journal *j, midi_error error) {
+	j->error_code = error;
+	j->error = midi_error_string(error);
+	return -1;
+}
+
+static size_t *find_slot(const midi_journal *j, const char *path) {
+	size_t slot = midi_hash(path, strlen(path), MIDI_HASH_SEED) & (j->table_size - 1);
+	while(j->table[slot] != 0 && strcmp(j->entries[j->table[slot] - 1].path, path) != 0) {
+		slot = (slot + 1) & (j->table_size - 1);
+	}
+	return &j->table[slot];
+}
+
+static int grow_table(midi_journal *j) {
+	size_t *old = j->table;
+	size_t old_size = j->table_size;
+	j->table_size = old_size > 0 ? old_size * 2 : 1024;
+	j->table = calloc(j->table_size, sizeof(size_t));
+	if(j->table == NULL) return -1;
+	for(size_t slot = 0; slot < old_size; slot++) {
+		if(old[slot] != 0) *find_slot(j, j->entries[old[slot] - 1].path) = old[slot];
+	}
+	free(old);
+	return 0;
+}
+
+// takes over entry->path
+static int load_entry(midi_journal *j, midi_journal_entry *entry) {
+	if((j->number_of_entries + 1) * 2 > j->table_size && grow_table(j) < 0) return -1;
+	size_t *slot = find_slot(j, entry->path);
+	if(*slot != 0) {
+		// a later line for the same path
+		midi_journal_entry *old = &j->entries[*slot - 1];
+		free(old->path);
+		*old = *entry;
+		return 0;
+	}
+	if(j->number_of_entries == j->capacity) {
+		size_t capacity = j->capacity > 0 ? j->capacity * 2 : 1024;
+		midi_journal_entry *entries = realloc(j->entries, capacity * sizeof(midi_journal_entry));
+		if(entries == NULL) return -1;
+		j->entries = entries;
+		j->capacity = capacity;
+	}
+	j->entries[j->number_of_entries++] = *entry;
+	*slot = j->number_of_entries;
+	return 0;
+}
+
+// one line without its newline, malformed lines are skipped
+static int parse_line(midi_journal *j, const char *line, size_t len) {
+	char *end;
+	midi_journal_entry entry = { 0 };
+	const char *tab = memchr(line, '\t', len);
+	if(tab == NULL) return 0;
+	if((size_t)(tab - line) == 2 && strncmp(line, JOURNAL_STATUS_ARR[MIDI_JOURNAL_OK], 2) == 0) {
+		entry.status = MIDI_JOURNAL_OK;
+	} else if((size_t)(tab - line) == 6 && strncmp(line, JOURNAL_STATUS_ARR[MIDI_JOURNAL_FAILED], 6) == 0) {
+		entry.status = MIDI_JOURNAL_FAILED;
+	} else {
+		return 0;
+	}
+	// the numbers end in tabs well before the end of the line
+	entry.size = strtoull(tab + 1, &end, 10);
+	if(*end != '\t') return 0;
+	entry.mtime = strtoll(end + 1, &end, 10);
+	if(*end != '\t') return 0;
+	entry.hash = strtoull(end + 1, &end, 16);
+	if(*end != '\t') return 0;
+	const char *path = end + 1;
+	size_t path_len = line + len - path;
+	entry.path = malloc(path_len + 1);
+	if(entry.path == NULL) return -1;
+	size_t n = 0;
+	for(size_t i = 0; i < path_len; i++) {
+		char c = path[i];
+		if(c == '\\' && i + 1 < path_len) {
+			c = path[++i];
+			if(c == 't') c = '\t';
+			if(c == 'n') c = '\n';
+		}
+		entry.path[n++] = c;
+	}
+	entry.path[n] = '\0';
+	if(load_entry(j, &entry) < 0) {
+		free(entry.path);
+		return -1;
+	}
+	return 0;
+}
+
+int midi_journal_open(midi_journal *j, const char *filename) {
+	memset(j, 0, sizeof(*j));
+	j->fd = -1;
+	pthread_mutex_init(&j->lock, NULL);
+	j->last_sync = time(NULL);
+	if(grow_table(j) < 0) return fail(j, MIDI_ERROR_OUT_OF_MEMORY);
+
+	// what the earlier runs wrote, up to the last complete line
+	size_t complete = 0;
+	midi_reader in;
+	if(midi_reader_open(&in, filename) == 0) {
+		const char *data = (const char *)in.data;
+		size_t start = 0;
+		for(size_t i = 0; i < in.size; i++) {
+			if(data[i] != '\n') continue;
+			if(parse_line(j, data + start, i - start) < 0) {
+				midi_reader_close(&in);
+				return fail(j, MIDI_ERROR_OUT_OF_MEMORY);
+			}
+			start = i + 1;
+		}
+		complete = start;
+		midi_reader_close(&in);
+	}
+
+	j->fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0666);
+	if(j->fd < 0) return fail(j, MIDI_ERROR_FILE_NOT_FOUND);
+	// drop a line torn by a crash, appends go after the last complete one
+	off_t size = lseek(j->fd, 0, SEEK_END);
+	if(size > (off_t)complete && ftruncate(j->fd, complete) < 0) return fail(j, MIDI_ERROR_WRITE_FAILED);
+	j->error = midi_error_string(MIDI_OK);
+	return 0;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+	while(len > 0) {
+		ssize_t n = write(fd, data, len);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return -1;
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// appends one line to the pending buffer, with j->lock held
+static int append_line(midi_journal *j, const midi_journal_entry *entry) {
+	size_t path_len = strlen(entry->path);
+	size_t needed = j->pending_len + 64 + path_len * 2;
+	if(needed > j->pending_capacity) {
+		size_t capacity = MAX(needed, j->pending_capacity * 2);
+		char *pending = realloc(j->pending, capacity);
+		if(pending == NULL) return -1;
+		j->pending = pending;
+		j->pending_capacity = capacity;
+	}
+	char *p = j->pending + j->pending_len;
+	p += sprintf(p, "%s\t%llu\t%lld\t%016llx\t", JOURNAL_STATUS_ARR[entry->status], entry->size, entry->mtime, entry->hash);
+	for(size_t i = 0; i < path_len; i++) {
+		char c = entry->path[i];
+		if(c == '\\' || c == '\t' || c == '\n') {
+			*p++ = '\\';
+			c = c == '\t' ? 't' : c == '\n' ? 'n' : c;
+		}
+		*p++ = c;
+	}
+	*p++ = '\n';
+	j->pending_len = p - j->pending;
+	j->pending_entries++;
+	return 0;
+}
+
+int midi_journal_add(midi_journal *j, const midi_journal_entry *entry) {
+	pthread_mutex_lock(&j->lock);
+	if(append_line(j, entry) < 0) {
+		fail(j, MIDI_ERROR_OUT_OF_MEMORY);
+		pthread_mutex_unlock(&j->lock);
+		return -1;
+	}
+	time_t now = time(NULL);
+	bool due = j->pending_entries >= MIDI_JOURNAL_SYNC_ENTRIES || now - j->last_sync >= MIDI_JOURNAL_SYNC_SECONDS;
+	if(!due || j->syncing) {
+		pthread_mutex_unlock(&j->lock);
+		return 0;
+	}
+	// take the batch and write it without holding the lock, the other
+	// workers go on collecting into a new buffer meanwhile
+	char *batch = j->pending;
+	size_t batch_len = j->pending_len;
+	j->pending = NULL;
+	j->pending_len = 0;
+	j->pending_capacity = 0;
+	j->pending_entries = 0;
+	j->syncing = true;
+	pthread_mutex_unlock(&j->lock);
+
+	int result = write_all(j->fd, batch, batch_len) < 0 || fdatasync(j->fd) < 0 ? -1 : 0;
+	free(batch);
+
+	pthread_mutex_lock(&j->lock);
+	j->syncing = false;
+	j->last_sync = now;
+	if(result < 0) fail(j, MIDI_ERROR_WRITE_FAILED);
+	pthread_mutex_unlock(&j->lock);
+	return result;
+}
+
+int midi_journal_close(midi_journal *j) {
+	int result = j->error_code == MIDI_OK ? 0 : -1;
+	if(j->fd >= 0) {
+		if(write_all(j->fd, j->pending, j->pending_len) < 0 || fdatasync(j->fd) < 0) result = fail(j, MIDI_ERROR_WRITE_FAILED);
+		close(j->fd);
+	}
+	for(size_t i = 0; i < j->number_of_entries; i++) free(j->entries[i].path);
+	free(j->entries);
+	free(j->table);
+	free(j->pending);
+	pthread_mutex_destroy(&j->lock);
+	j->fd = -1;
+	j->entries = NULL;
+	j->table = NULL;
+	j->pending = NULL;
+	j->number_of_entries = 0;
+	return result;
+}
+
+const midi_journal_entry *midi_journal_find(const midi_journal *j, const char *path) {
+	size_t index = *find_slot(j, path);
+	return index != 0 ? &j->entries[index - 1] : NULL;
+}
@@ -0,0 +1,72 @@
+#ifndef MIDI_JOURNAL_H
+#define MIDI_JOURNAL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "midi_common.h"
+
+// Append-only journal of a batch conversion, so an interrupted run can pick
+// up where it stopped. One text line per converted input:
+//
+//   status <tab> size <tab> mtime (ns) <tab> hash (16 hex digits) <tab> path
+//
+// status is "ok" or "failed", tabs, newlines and backslashes in the path are
+// escaped. Later lines for a path replace earlier ones. Lines are collected
+// in memory and written with one write + fdatasync every MIDI_JOURNAL_SYNC_ENTRIES
+// entries or MIDI_JOURNAL_SYNC_SECONDS seconds; a line torn by a crash is
+// dropped when the journal is opened again.
+
+#define MIDI_JOURNAL_SYNC_ENTRIES 256
+#define MIDI_JOURNAL_SYNC_SECONDS 1
+
+typedef enum {
+	MIDI_JOURNAL_OK,
+	MIDI_JOURNAL_FAILED
+} midi_journal_status;
+
+typedef struct {
+	char *path;
+	unsigned long long size;
+	long long mtime;         // nanoseconds since the epoch
+	unsigned long long hash; // midi_hash of the content
+	midi_journal_status status;
+} midi_journal_entry;
+
+typedef struct {
+	int fd;
+
+	// entries of the earlier runs, the last one per path, found through the table
+	midi_journal_entry *entries;
+	size_t number_of_entries;
+	size_t capacity;
+	size_t *table;           // open addressing, entry index + 1, 0 is empty
+	size_t table_size;
+
+	// lines of this run that are not on disk yet
+	pthread_mutex_t lock;
+	char *pending;
+	size_t pending_len;
+	size_t pending_capacity;
+	size_t pending_entries;
+	time_t last_sync;
+	bool syncing;            // one thread writes at a time, the others keep collecting
+
+	midi_error error_code;
+	const char *error;       // midi_error_string(error_code)
+} midi_journal;
+
+// loads the journal in filename, creating it when missing, and opens it for appending.
+// Returns 0, or -1 with j->error_code set
+int midi_journal_open(midi_journal *j, const char *filename);
+// writes and syncs what is left, returns -1 if any write failed
+int midi_journal_close(midi_journal *j);
+
+// the last entry for path from the earlier runs, NULL if there is none
+const midi_journal_entry *midi_journal_find(const midi_journal *j, const char *path);
+// safe to call from several threads, returns -1 when writing the journal failed
+int midi_journal_add(midi_journal *j, const midi_journal_entry *entry);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_common.h"
+#include "midi_reader.h"
+#include "midi_merge.h"
+
+static int fail(midi_merge *m, midi_error code) {
+	m->error_code = code;
+	m->error = midi_error_string(code);
+	return -1;
+}
+
+// parser callback, keeps the event for the merge
+static int hold_event(void *user, const midi_event *ev) {
+	midi_merge_track *t = user;
+	if(ev->kind == MIDI_EVENT_TRACK_END) {
+		t->done = true;
+	} else if(ev->kind == MIDI_EVENT_CHANNEL || ev->kind == MIDI_EVENT_META || ev->kind == MIDI_EVENT_SYSEX) {
+		t->event = *ev;
+		t->has_event = true;
+	}
+	return 0;
+}
+
+// decodes the next event of a track, false when the track has none left
+static bool advance(midi_merge *m, midi_merge_track *t) {
+	t->has_event = false;
+	while(!t->has_event && !t->done) {
+		size_t used;
+		if(midi_parser_feed_one(&t->parser, t->data, t->remaining, &used) < 0) {
+			fail(m, t->parser.error_code);
+			return false;
+		}
+		t->data += used;
+		t->remaining -= used;
+		if(!t->has_event && used == 0) {
+			// nothing left to decode
+			if(midi_parser_finish(&t->parser) < 0) fail(m, t->parser.error_code);
+			t->done = true;
+		}
+	}
+	return t->has_event;
+}
+
+static bool earlier(const midi_merge *m, int a, int b) {
+	unsigned int tick_a = m->tracks[a].event.tick, tick_b = m->tracks[b].event.tick;
+	return tick_a < tick_b || (tick_a == tick_b && a < b);
+}
+
+static void sift_down(midi_merge *m, int i) {
+	for(;;) {
+		int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+		if(left < m->heap_size && earlier(m, m->heap[left], m->heap[smallest])) smallest = left;
+		if(right < m->heap_size && earlier(m, m->heap[right], m->heap[smallest])) smallest = right;
+		if(smallest == i) return;
+		int swap = m->heap[i];
+		m->heap[i] = m->heap[smallest];
+		m->heap[smallest] = swap;
+		i = smallest;
+	}
+}
+
+int midi_merge_init(midi_merge *m, const unsigned char *data, size_t size) {
+	memset(m, 0, sizeof(*m));
+	midi_reader in = { .data = data, .size = size };
+	const unsigned char *file_header = midi_reader_bytes(&in, 4);
+	if(file_header == NULL || memcmp(file_header, FILE_HEADER, 4) != 0) return fail(m, MIDI_ERROR_NOT_MIDI);
+	m->header.kind = MIDI_EVENT_HEADER;
+	if(!midi_reader_u32(&in, &m->header.header_size) ||
+		!midi_reader_u16(&in, &m->header.format) ||
+		!midi_reader_u16(&in, &m->header.number_of_tracks) ||
+		!midi_reader_u16(&in, &m->header.division)) {
+		return fail(m, MIDI_ERROR_END_OF_FILE);
+	}
+	if(m->header.header_size < 6) return fail(m, MIDI_ERROR_HEADER_TOO_SHORT);
+
+	int number_of_tracks = m->header.number_of_tracks;
+	in.pos = 8 + m->header.header_size;
+	midi_track_chunk *chunks = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(midi_track_chunk));
+	m->tracks = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(midi_merge_track));
+	m->heap = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(int));
+	if(chunks == NULL || m->tracks == NULL || m->heap == NULL) {
+		free(chunks);
+		midi_merge_free(m);
+		return fail(m, MIDI_ERROR_OUT_OF_MEMORY);
+	}
+	if(midi_reader_find_tracks(&in, chunks, number_of_tracks) < number_of_tracks) {
+		free(chunks);
+		midi_merge_free(m);
+		return fail(m, MIDI_ERROR_NO_TRACK);
+	}
+
+	m->number_of_tracks = number_of_tracks;
+	for(int track = 0; track < number_of_tracks; track++) {
+		midi_merge_track *t = &m->tracks[track];
+		t->data = data + chunks[track].offset;
+		t->remaining = chunks[track].length;
+		midi_parser_init_track(&t->parser, track, chunks[track].length, hold_event, t);
+		if(advance(m, t)) m->heap[m->heap_size++] = track;
+		if(m->error_code != MIDI_OK) break;
+	}
+	free(chunks);
+	if(m->error_code != MIDI_OK) {
+		midi_error code = m->error_code;
+		midi_merge_free(m);
+		return fail(m, code);
+	}
+	for(int i = m->heap_size / 2 - 1; i >= 0; i--) sift_down(m, i);
+	return 0;
+}
+
+void midi_merge_free(midi_merge *m) {
+	for(int track = 0; track < m->number_of_tracks; track++) midi_parser_free(&m->tracks[track].parser);
+	free(m->tracks);
+	free(m->heap);
+	m->tracks = NULL;
+	m->heap = NULL;
+	m->number_of_tracks = 0;
+	m->heap_size = 0;
+}
+
+int midi_merge_next(midi_merge *m, const midi_event **event) {
+	if(m->error_code != MIDI_OK) return -1;
+	if(m->heap_size == 0) return 0;
+	int track = m->heap[0];
+	midi_merge_track *t = &m->tracks[track];
+	// the event has to outlive the refill of its track
+	m->current = t->event;
+	*event = &m->current;
+	if(!advance(m, t)) {
+		if(m->error_code != MIDI_OK) return -1;
+		m->heap[0] = m->heap[--m->heap_size];
+	}
+	sift_down(m, 0);
+	return 1;
+}
@@ -0,0 +1,42 @@
+#ifndef MIDI_MERGE_H
+#define MIDI_MERGE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "midi_common.h"
+#include "midi_parser.h"
+
+// All tracks of a file in one timeline: the channel, meta and sysex events
+// come out ordered by absolute tick, events on the same tick in track order
+// and within a track in file order. Each track is decoded lazily, one event
+// ahead, and a binary heap over the tracks picks the next one, so memory
+// grows with the number of tracks, not with the number of events.
+
+typedef struct {
+	midi_parser parser;
+	const unsigned char *data; // rest of the MTrk chunk body
+	size_t remaining;
+	midi_event event;          // next event of the track
+	bool has_event;
+	bool done;
+} midi_merge_track;
+
+typedef struct {
+	midi_event header;         // MIDI_EVENT_HEADER of the file
+	int number_of_tracks;
+	midi_merge_track *tracks;
+	int *heap;                 // tracks with an event waiting, earliest first
+	int heap_size;
+	midi_event current;        // what midi_merge_next handed out last
+	midi_error error_code;
+	const char *error;         // midi_error_string(error_code)
+} midi_merge;
+
+// data must hold the whole midi file and stay valid until midi_merge_free
+int midi_merge_init(midi_merge *m, const unsigned char *data, size_t size);
+void midi_merge_free(midi_merge *m);
+// 1 with *event set to the next event (valid until the next call), 0 at the end, -1 on error
+int midi_merge_next(midi_merge *m, const midi_event **event);
+
+#endif
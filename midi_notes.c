@@ -0,0 +1,96 @@
+#include <string.h>
+
+#include "midi_common.h"
+#include "midi_notes.h"
+
+void midi_notes_init(midi_notes *n, midi_notes_order order, midi_note_callback callback, void *user) {
+	memset(n, 0, sizeof(*n));
+	n->order = order;
+	n->callback = callback;
+	n->user = user;
+}
+
+static void emit(midi_notes *n, midi_note_kind kind, int channel, int key, const midi_notes_sounding *s, unsigned int end_tick, unsigned char off_velocity) {
+	midi_note note = {
+		.kind = kind,
+		.start = s->tick,
+		.duration = end_tick - s->tick,
+		.channel = channel,
+		.key = key,
+		.velocity = s->velocity,
+		.off_velocity = off_velocity,
+		.index = s->index
+	};
+	if(kind != MIDI_NOTE_PAIRED) n->number_of_dangling++;
+	n->callback(n->user, &note);
+}
+
+static void note_on(midi_notes *n, unsigned int tick, int channel, int key, unsigned char velocity) {
+	unsigned char *first = &n->first[channel][key];
+	unsigned char *count = &n->count[channel][key];
+	midi_notes_sounding *stack = n->sounding[channel][key];
+	if(*count == MIDI_NOTES_MAX_OVERLAP) {
+		// no room, the oldest sounding note ends here
+		emit(n, MIDI_NOTE_TRUNCATED, channel, key, &stack[*first], tick, 0);
+		*first = (*first + 1) % MIDI_NOTES_MAX_OVERLAP;
+		(*count)--;
+	}
+	midi_notes_sounding *s = &stack[(*first + *count) % MIDI_NOTES_MAX_OVERLAP];
+	s->tick = tick;
+	s->index = n->number_of_notes++;
+	s->velocity = velocity;
+	(*count)++;
+}
+
+static void note_off(midi_notes *n, unsigned int tick, int channel, int key, unsigned char velocity) {
+	unsigned char *first = &n->first[channel][key];
+	unsigned char *count = &n->count[channel][key];
+	midi_notes_sounding *stack = n->sounding[channel][key];
+	if(*count == 0) {
+		midi_notes_sounding stray = { .tick = tick, .index = UINT32_MAX, .velocity = 0 };
+		emit(n, MIDI_NOTE_STRAY_OFF, channel, key, &stray, tick, velocity);
+		return;
+	}
+	if(n->order == MIDI_NOTES_FIFO) {
+		emit(n, MIDI_NOTE_PAIRED, channel, key, &stack[*first], tick, velocity);
+		*first = (*first + 1) % MIDI_NOTES_MAX_OVERLAP;
+	} else {
+		emit(n, MIDI_NOTE_PAIRED, channel, key, &stack[(*first + *count - 1) % MIDI_NOTES_MAX_OVERLAP], tick, velocity);
+	}
+	(*count)--;
+}
+
+void midi_notes_event(midi_notes *n, unsigned int tick, unsigned char status, unsigned char data1, unsigned char data2) {
+	int command = get_high_bits(status);
+	int channel = get_low_bits(status);
+	int key = data1 & 0x7F;
+	if(command == NOTE_ON && data2 > 0) {
+		note_on(n, tick, channel, key, data2);
+	} else if(command == NOTE_ON || command == NOTE_OFF) {
+		note_off(n, tick, channel, key, data2);
+	}
+}
+
+void midi_notes_finish(midi_notes *n, unsigned int end_tick) {
+	// the stacks hold their notes oldest first, a merge by index puts them in start order
+	for(;;) {
+		int best_channel = -1, best_key = 0;
+		uint32_t best_index = UINT32_MAX;
+		for(int channel = 0; channel < 16; channel++) {
+			for(int key = 0; key < 128; key++) {
+				if(n->count[channel][key] == 0) continue;
+				const midi_notes_sounding *s = &n->sounding[channel][key][n->first[channel][key]];
+				if(s->index < best_index) {
+					best_index = s->index;
+					best_channel = channel;
+					best_key = key;
+				}
+			}
+		}
+		if(best_channel < 0) break;
+		unsigned char *first = &n->first[best_channel][best_key];
+		emit(n, MIDI_NOTE_UNCLOSED, best_channel, best_key, &n->sounding[best_channel][best_key][*first], end_tick, 0);
+		*first = (*first + 1) % MIDI_NOTES_MAX_OVERLAP;
+		n->count[best_channel][best_key]--;
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef MIDI_NOTES_H
+#define MIDI_NOTES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pairs the Note ON and Note OFF events of one track into notes with a
+// start and a duration. A Note ON with velocity 0 counts as Note OFF.
+// Every channel and key has a small fixed stack of sounding notes, so
+// matching is O(1) and nothing is allocated while the events go by.
+// When one key is struck again before it is released, the order decides
+// which of the sounding notes a Note OFF ends: FIFO the oldest (the usual
+// reading of overlapping notes), LIFO the newest.
+
+#define MIDI_NOTES_MAX_OVERLAP 8 // sounding notes per channel and key
+
+typedef enum {
+	MIDI_NOTES_FIFO,
+	MIDI_NOTES_LIFO
+} midi_notes_order;
+
+typedef enum {
+	MIDI_NOTE_PAIRED,        // Note ON ended by a Note OFF
+	MIDI_NOTE_UNCLOSED,      // still sounding at the end of the track, runs to the end
+	MIDI_NOTE_TRUNCATED,     // pushed out by one overlap too many, runs to the Note ON that did it
+	MIDI_NOTE_STRAY_OFF      // Note OFF without a sounding note, duration 0 and no index
+} midi_note_kind;
+
+typedef struct {
+	midi_note_kind kind;
+	unsigned int start;      // absolute ticks
+	unsigned int duration;   // ticks
+	unsigned char channel;
+	unsigned char key;
+	unsigned char velocity;
+	unsigned char off_velocity;
+	uint32_t index;          // of its Note ON among the Note ONs of the track, gives notes in start order
+} midi_note;
+
+typedef void (*midi_note_callback)(void *user, const midi_note *note);
+
+typedef struct {
+	unsigned int tick;
+	uint32_t index;
+	unsigned char velocity;
+} midi_notes_sounding;
+
+typedef struct {
+	midi_notes_order order;
+	midi_note_callback callback;
+	void *user;
+	uint32_t number_of_notes;      // Note ONs so far
+	unsigned int number_of_dangling; // notes that are not MIDI_NOTE_PAIRED
+	unsigned char first[16][128];  // oldest sounding note, the stacks are rings
+	unsigned char count[16][128];
+	midi_notes_sounding sounding[16][128][MIDI_NOTES_MAX_OVERLAP];
+} midi_notes;
+
+// ~200 KB, best kept on the heap
+void midi_notes_init(midi_notes *n, midi_notes_order order, midi_note_callback callback, void *user);
+// any channel event, everything but Note ON and Note OFF is ignored
+void midi_notes_event(midi_notes *n, unsigned int tick, unsigned char status, unsigned char data1, unsigned char data2);
+// ends the notes still sounding at end_tick, in start order
+void midi_notes_finish(midi_notes *n, unsigned int end_tick);
+
+#endif
@@ -0,0 +1,49 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include "midi_common.h"
+#include "midi_parallel.h"
+
+const int MAX_THREADS = 64;
+
+typedef struct {
+	void (*work)(void *ctx, int index);
+	void *ctx;
+	int count;
+	int next;
+	pthread_mutex_t lock;
+} parallel_pool;
+
+static void *parallel_worker(void *arg) {
+	parallel_pool *pool = arg;
+	for(;;) {
+		pthread_mutex_lock(&pool->lock);
+		int next = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		if(next >= pool->count) break;
+		pool->work(pool->ctx, next);
+	}
+	return NULL;
+}
+
+void midi_parallel_for(int count, int max_threads, void (*work)(void *ctx, int index), void *ctx) {
+	parallel_pool pool = { .work = work, .ctx = ctx, .count = count, .next = 0 };
+	pthread_mutex_init(&pool.lock, NULL);
+
+	int number_of_threads = max_threads > 0 ? max_threads : MAX_THREADS;
+	long online_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(max_threads <= 0 && online_cpus > 0) number_of_threads = MIN(number_of_threads, online_cpus);
+	number_of_threads = MIN(number_of_threads, MIN(count, MAX_THREADS));
+
+	pthread_t threads[MAX_THREADS];
+	int started = 0;
+	for(int i = 1; i < number_of_threads; i++) {
+		if(pthread_create(&threads[started], NULL, parallel_worker, &pool) != 0) break;
+		started++;
+	}
+	parallel_worker(&pool); // the calling thread works too
+	for(int i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&pool.lock);
+}
@@ -0,0 +1,8 @@
+#ifndef MIDI_PARALLEL_H
+#define MIDI_PARALLEL_H
+
+// Calls work(ctx, i) for every i in [0, count) on up to max_threads threads
+// (0 picks one per online cpu). Returns when every call has finished.
+void midi_parallel_for(int count, int max_threads, void (*work)(void *ctx, int index), void *ctx);
+
+#endif
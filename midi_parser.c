@@ -0,0 +1,388 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_common.h"
+#include "midi_parser.h"
+#include "midi_vlq.h"
+
+enum {
+	PS_FILE_HEADER,
+	PS_CHUNK_HEADER,
+	PS_SKIP,
+	PS_DELTA,
+	PS_STATUS,
+	PS_DATA,
+	PS_META_TYPE,
+	PS_LENGTH,
+	PS_PAYLOAD,
+	PS_DONE,
+	PS_ERROR
+};
+
+static bool is_track_state(int state) {
+	return state >= PS_DELTA && state <= PS_PAYLOAD;
+}
+
+static int fail(midi_parser *p, midi_error code) {
+	p->state = PS_ERROR;
+	p->error_code = code;
+	p->error = midi_error_string(code);
+	return -1;
+}
+
+// a stop request is picked up before the next byte is consumed
+static void emit(midi_parser *p, midi_event_kind kind) {
+	p->event.kind = kind;
+	p->event.track = p->track;
+	p->event_done = p->one_event;
+	if(p->callback(p->user, &p->event) != 0 && p->error_code == MIDI_OK) {
+		p->error_code = MIDI_ERROR_STOPPED;
+		p->error = midi_error_string(MIDI_ERROR_STOPPED);
+	}
+}
+
+static void begin_track(midi_parser *p, size_t length) {
+	p->track_remaining = length;
+	p->tick = 0;
+	p->running_status = 0;
+	p->vlq = 0;
+	p->vlq_bytes = 0;
+	p->event.track_length = length;
+	emit(p, MIDI_EVENT_TRACK_BEGIN);
+	p->state = PS_DELTA;
+}
+
+static void end_track(midi_parser *p) {
+	emit(p, MIDI_EVENT_TRACK_END);
+	p->skip_remaining = p->track_remaining; // anything after End of Track
+	p->track_remaining = 0;
+	if(p->skip_remaining > 0) {
+		p->state = PS_SKIP;
+	} else {
+		p->state = p->track_mode ? PS_DONE : PS_CHUNK_HEADER;
+	}
+}
+
+static int append_payload(midi_parser *p, const unsigned char *data, size_t len) {
+	if(p->buffer_len + len > p->buffer_capacity) {
+		size_t capacity = p->buffer_capacity ? p->buffer_capacity : 256;
+		while(capacity < p->buffer_len + len) capacity *= 2;
+		unsigned char *grown = realloc(p->buffer, capacity);
+		if(grown == NULL) return fail(p, MIDI_ERROR_OUT_OF_MEMORY);
+		p->buffer = grown;
+		p->buffer_capacity = capacity;
+	}
+	memcpy(p->buffer + p->buffer_len, data, len);
+	p->buffer_len += len;
+	return 0;
+}
+
+static void finish_meta(midi_parser *p, const unsigned char *payload, size_t len) {
+	p->event.payload = payload;
+	p->event.payload_len = len;
+	emit(p, MIDI_EVENT_META);
+	p->buffer_len = 0;
+	if(p->event.type == END_OF_TRACK) {
+		end_track(p);
+	} else {
+		p->state = PS_DELTA;
+	}
+}
+
+static void finish_sysex(midi_parser *p, const unsigned char *payload, size_t len) {
+	p->event.payload = payload;
+	p->event.payload_len = len;
+	emit(p, MIDI_EVENT_SYSEX);
+	p->buffer_len = 0;
+	p->state = PS_DELTA;
+}
+
+static void finish_payload(midi_parser *p, const unsigned char *payload, size_t len) {
+	if(p->event.status == META_EVENT) {
+		finish_meta(p, payload, len);
+	} else {
+		finish_sysex(p, payload, len);
+	}
+}
+
+static void begin_payload(midi_parser *p, size_t length) {
+	p->payload_needed = length;
+	if(length == 0) {
+		finish_payload(p, NULL, 0);
+	} else {
+		p->state = PS_PAYLOAD;
+	}
+}
+
+static int parse_file_header(midi_parser *p) {
+	const unsigned char *h = p->header;
+	if(memcmp(h, FILE_HEADER, 4) != 0) return fail(p, MIDI_ERROR_NOT_MIDI);
+	p->event.header_size = ((unsigned int)h[4] << 24) | ((unsigned int)h[5] << 16) | ((unsigned int)h[6] << 8) | h[7];
+	if(p->event.header_size < 6) return fail(p, MIDI_ERROR_HEADER_TOO_SHORT);
+	p->event.format = (h[8] << 8) | h[9];
+	p->event.number_of_tracks = (h[10] << 8) | h[11];
+	p->event.division = (h[12] << 8) | h[13];
+	emit(p, MIDI_EVENT_HEADER);
+	p->header_len = 0;
+	p->skip_remaining = p->event.header_size - 6;
+	p->state = p->skip_remaining > 0 ? PS_SKIP : PS_CHUNK_HEADER;
+	return 0;
+}
+
+static void parse_chunk_header(midi_parser *p) {
+	const unsigned char *h = p->header;
+	size_t length = ((size_t)h[4] << 24) | ((size_t)h[5] << 16) | ((size_t)h[6] << 8) | h[7];
+	p->header_len = 0;
+	if(memcmp(h, TRACK_HEADER, 4) == 0) {
+		p->track++;
+		begin_track(p, length);
+	} else {
+		// unknown chunk type, skip it
+		p->skip_remaining = length;
+		p->state = length > 0 ? PS_SKIP : PS_CHUNK_HEADER;
+	}
+}
+
+void midi_parser_init(midi_parser *p, midi_event_callback callback, void *user) {
+	memset(p, 0, sizeof(*p));
+	p->state = PS_FILE_HEADER;
+	p->callback = callback;
+	p->user = user;
+	p->track = -1;
+}
+
+void midi_parser_init_track(midi_parser *p, int track, size_t length, midi_event_callback callback, void *user) {
+	midi_parser_init(p, callback, user);
+	p->track_mode = true;
+	p->track = track;
+	begin_track(p, length);
+}
+
+void midi_parser_init_track_at(midi_parser *p, int track, size_t length, const midi_parser_position *at, midi_event_callback callback, void *user) {
+	midi_parser_init_track(p, track, length, callback, user);
+	if(at->offset > length) {
+		fail(p, MIDI_ERROR_TRACK_TRUNCATED);
+		return;
+	}
+	p->track_remaining = length - at->offset;
+	p->tick = at->tick;
+	p->running_status = at->running_status;
+}
+
+void midi_parser_position_after(const midi_parser *p, midi_parser_position *position) {
+	position->offset = p->event.track_length - p->track_remaining;
+	position->tick = p->tick;
+	position->running_status = p->running_status;
+}
+
+void midi_parser_free(midi_parser *p) {
+	free(p->buffer);
+	p->buffer = NULL;
+	p->buffer_len = 0;
+	p->buffer_capacity = 0;
+}
+
+static int feed(midi_parser *p, const unsigned char *data, size_t len, size_t *used) {
+	size_t i = 0;
+	for(;;) {
+		if(p->error_code != MIDI_OK) return fail(p, p->error_code);
+		if(p->event_done) break;
+
+		// the chunk length is the only end marker a track is guaranteed to have
+		if(is_track_state(p->state) && p->track_remaining == 0) {
+			if(p->state != PS_DELTA || p->vlq_bytes > 0) return fail(p, MIDI_ERROR_TRACK_TRUNCATED);
+			end_track(p);
+			continue;
+		}
+		if(i >= len) break;
+
+		size_t available = len - i;
+		if(is_track_state(p->state)) available = MIN(available, p->track_remaining);
+
+		switch(p->state) {
+		case PS_FILE_HEADER: {
+			size_t n = MIN(available, sizeof(p->header) - p->header_len);
+			memcpy(p->header + p->header_len, data + i, n);
+			p->header_len += n;
+			i += n;
+			if(p->header_len == sizeof(p->header) && parse_file_header(p) < 0) return -1;
+			break;
+		}
+		case PS_CHUNK_HEADER: {
+			size_t n = MIN(available, 8 - (size_t)p->header_len);
+			memcpy(p->header + p->header_len, data + i, n);
+			p->header_len += n;
+			i += n;
+			if(p->header_len == 8) parse_chunk_header(p);
+			break;
+		}
+		case PS_SKIP: {
+			size_t n = MIN(available, p->skip_remaining);
+			p->skip_remaining -= n;
+			i += n;
+			if(p->skip_remaining == 0) p->state = p->track_mode ? PS_DONE : PS_CHUNK_HEADER;
+			break;
+		}
+		case PS_DELTA: {
+			if(p->vlq_bytes == 0) {
+				// whole delta time inside the slice, decoded in one step
+				int n = midi_vlq_length(data + i, available);
+				if(n > 0) {
+					p->event.delta = midi_vlq_value(data + i, n);
+					i += n;
+					p->track_remaining -= n;
+					p->tick += p->event.delta;
+					p->event.tick = p->tick;
+					p->state = PS_STATUS;
+					break;
+				}
+				if(available >= DELTA_TIME_MAX_BYTES) return fail(p, MIDI_ERROR_DELTA_TIME_TOO_LONG);
+			}
+			unsigned char c = data[i++];
+			p->track_remaining--;
+			if(p->vlq_bytes >= DELTA_TIME_MAX_BYTES) return fail(p, MIDI_ERROR_DELTA_TIME_TOO_LONG);
+			p->vlq = (p->vlq << 7) | (c & 0x7F);
+			p->vlq_bytes++;
+			if(c < 0x80) {
+				p->event.delta = p->vlq;
+				p->tick += p->vlq;
+				p->event.tick = p->tick;
+				p->vlq = 0;
+				p->vlq_bytes = 0;
+				p->state = PS_STATUS;
+			}
+			break;
+		}
+		case PS_STATUS: {
+			unsigned char c = data[i++];
+			p->track_remaining--;
+			unsigned char status = c;
+			if(c < 0x80) {
+				// running status, the byte is the first data byte of a repeated command
+				if(p->running_status == 0) return fail(p, MIDI_ERROR_UNKNOWN_EVENT);
+				status = p->running_status;
+			}
+			const midi_status_entry *entry = &MIDI_STATUS_TABLE[status];
+			p->event.status = status;
+			p->event.payload = NULL;
+			p->event.payload_len = 0;
+			switch(entry->kind) {
+			case MIDI_STATUS_CHANNEL:
+				p->running_status = status;
+				p->event.data[0] = 0;
+				p->event.data[1] = 0;
+				p->event.data_len = entry->data_length;
+				p->data_needed = entry->data_length;
+				p->state = PS_DATA;
+				if(c < 0x80) {
+					p->event.data[0] = c;
+					if(--p->data_needed == 0) {
+						emit(p, MIDI_EVENT_CHANNEL);
+						p->state = PS_DELTA;
+					}
+				}
+				break;
+			case MIDI_STATUS_META:
+				p->running_status = 0;
+				p->state = PS_META_TYPE;
+				break;
+			case MIDI_STATUS_SYSEX:
+				p->running_status = 0;
+				p->state = PS_LENGTH;
+				break;
+			default:
+				return fail(p, MIDI_ERROR_UNKNOWN_EVENT);
+			}
+			break;
+		}
+		case PS_DATA: {
+			p->event.data[p->event.data_len - p->data_needed] = data[i++];
+			p->track_remaining--;
+			if(--p->data_needed == 0) {
+				emit(p, MIDI_EVENT_CHANNEL);
+				p->state = PS_DELTA;
+			}
+			break;
+		}
+		case PS_META_TYPE: {
+			p->event.type = data[i++];
+			p->track_remaining--;
+			p->state = PS_LENGTH;
+			break;
+		}
+		case PS_LENGTH: {
+			// meta and sysex events carry their length, the payload is skipped without scanning
+			if(p->vlq_bytes == 0) {
+				int n = midi_vlq_length(data + i, available);
+				if(n > 0) {
+					size_t length = midi_vlq_value(data + i, n);
+					i += n;
+					p->track_remaining -= n;
+					begin_payload(p, length);
+					break;
+				}
+				if(available >= MIDI_VLQ_MAX_BYTES) return fail(p, MIDI_ERROR_LENGTH_TOO_LONG);
+			}
+			unsigned char c = data[i++];
+			p->track_remaining--;
+			if(p->vlq_bytes >= MIDI_VLQ_MAX_BYTES) return fail(p, MIDI_ERROR_LENGTH_TOO_LONG);
+			p->vlq = (p->vlq << 7) | (c & 0x7F);
+			p->vlq_bytes++;
+			if(c < 0x80) {
+				size_t length = p->vlq;
+				p->vlq = 0;
+				p->vlq_bytes = 0;
+				begin_payload(p, length);
+			}
+			break;
+		}
+		case PS_PAYLOAD: {
+			size_t n = MIN(available, p->payload_needed);
+			const unsigned char *chunk = data + i;
+			i += n;
+			p->track_remaining -= n;
+			p->payload_needed -= n;
+			if(p->payload_needed == 0 && p->buffer_len == 0) {
+				// whole payload inside this slice, hand it out without copying
+				finish_payload(p, chunk, n);
+			} else {
+				if(append_payload(p, chunk, n) < 0) return -1;
+				if(p->payload_needed == 0) finish_payload(p, p->buffer, p->buffer_len);
+			}
+			break;
+		}
+		case PS_DONE:
+			i = len;
+			break;
+		}
+	}
+	*used = i;
+	if(p->error_code != MIDI_OK) return fail(p, p->error_code);
+	return 0;
+}
+
+int midi_parser_feed(midi_parser *p, const unsigned char *data, size_t len) {
+	size_t used;
+	p->one_event = false;
+	p->event_done = false;
+	return feed(p, data, len, &used);
+}
+
+int midi_parser_feed_one(midi_parser *p, const unsigned char *data, size_t len, size_t *used) {
+	p->one_event = true;
+	p->event_done = false;
+	int result = feed(p, data, len, used);
+	p->event_done = false;
+	return result;
+}
+
+int midi_parser_finish(midi_parser *p) {
+	if(p->error_code != MIDI_OK) return fail(p, p->error_code);
+	if(is_track_state(p->state) || p->state == PS_FILE_HEADER || p->state == PS_SKIP) {
+		return fail(p, MIDI_ERROR_END_OF_FILE);
+	}
+	if(p->state == PS_CHUNK_HEADER && p->header_len > 0) {
+		return fail(p, MIDI_ERROR_END_OF_FILE);
+	}
+	return 0;
+}
@@ -0,0 +1,109 @@
+#ifndef MIDI_PARSER_H
+#define MIDI_PARSER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "midi_common.h"
+
+// Resumable push parser. The input can be handed over in slices of any
+// size (down to single bytes), every event is reported through the callback
+// as soon as its last byte has arrived. A callback returning anything but 0
+// stops the parser with MIDI_ERROR_STOPPED. The parser itself only allocates
+// when a meta or sysex payload is split over several slices.
+
+typedef enum {
+	MIDI_EVENT_HEADER,
+	MIDI_EVENT_TRACK_BEGIN,
+	MIDI_EVENT_CHANNEL,
+	MIDI_EVENT_META,
+	MIDI_EVENT_SYSEX,
+	MIDI_EVENT_TRACK_END
+} midi_event_kind;
+
+typedef struct {
+	midi_event_kind kind;
+	int track;                     // 0 based track number
+
+	// header
+	unsigned int header_size;
+	unsigned short format;
+	unsigned short number_of_tracks;
+	unsigned short division;
+
+	// track begin
+	size_t track_length;
+
+	// channel, meta and sysex events
+	unsigned int delta;            // delta time ticks
+	unsigned int tick;             // absolute ticks since the track start
+	unsigned char status;          // command byte, META_EVENT or SYSEX_EVENT
+	unsigned char type;            // meta event type
+	unsigned char data[2];         // channel event data bytes
+	int data_len;
+	const unsigned char *payload;  // meta / sysex data, only valid during the callback
+	size_t payload_len;
+} midi_event;
+
+typedef int (*midi_event_callback)(void *user, const midi_event *event);
+
+// where the parser stands between two events of a track, enough to pick up
+// decoding there later without going over the bytes before it
+typedef struct {
+	size_t offset;                 // into the MTrk chunk body, where the next event starts
+	unsigned int tick;             // absolute ticks of the event before offset
+	unsigned char running_status;
+} midi_parser_position;
+
+typedef struct {
+	int state;
+	midi_error error_code;
+	const char *error;             // midi_error_string(error_code)
+	bool track_mode;
+	bool one_event;                // midi_parser_feed_one: stop after the next event
+	bool event_done;
+
+	midi_event_callback callback;
+	void *user;
+	midi_event event;
+
+	unsigned char header[14];      // file and chunk headers collected across slices
+	int header_len;
+	size_t skip_remaining;
+
+	int track;
+	size_t track_remaining;
+	unsigned int tick;
+	unsigned char running_status;  // last channel status, 0 after meta and sysex
+
+	unsigned int vlq;
+	int vlq_bytes;
+	int data_needed;
+	size_t payload_needed;
+
+	unsigned char *buffer;         // payloads split over several slices
+	size_t buffer_len;
+	size_t buffer_capacity;
+} midi_parser;
+
+// parser for a whole file, starting at the MThd header
+void midi_parser_init(midi_parser *p, midi_event_callback callback, void *user);
+// parser for the body of one MTrk chunk of the given length
+void midi_parser_init_track(midi_parser *p, int track, size_t length, midi_event_callback callback, void *user);
+// parser for the rest of an MTrk chunk body, from a position saved with midi_parser_position_after
+void midi_parser_init_track_at(midi_parser *p, int track, size_t length, const midi_parser_position *at, midi_event_callback callback, void *user);
+void midi_parser_free(midi_parser *p);
+
+// inside the callback of a channel, meta or sysex event: the position right after it
+void midi_parser_position_after(const midi_parser *p, midi_parser_position *position);
+
+// both return 0 on success, -1 with p->error_code set on malformed input
+// or when a callback asked to stop
+int midi_parser_feed(midi_parser *p, const unsigned char *data, size_t len);
+int midi_parser_finish(midi_parser *p);
+// like midi_parser_feed, but returns as soon as one event went to the
+// callback, *used tells how much of data it took. Pulls events one at a
+// time from input that is all there, e.g. a mapped file
+int midi_parser_feed_one(midi_parser *p, const unsigned char *data, size_t len, size_t *used);
+
+#endif
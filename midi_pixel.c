@@ -0,0 +1,345 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_common.h"
+#include "midi_parallel.h"
+#include "midi_pixel.h"
+
+#define CLEAN 1
+#define EMPTY 0
+
+enum {
+	INSTRUMENT_NAME = 0x03,
+	MAX_NAMES = 8,
+	BASE_NOTE = 36           // pixel key 0
+};
+
+// what the pre-pass finds out about a track
+typedef struct {
+	int number_of_patterns;  // 0 for tracks without notes
+	int first_pattern;       // index of its first job
+	int number_of_names;
+	const midi_song_payload *names[MAX_NAMES]; // instrument name meta events, written as className
+} track_info;
+
+// one pattern of one track, quantized on its own
+typedef struct {
+	int track;
+	int pattern;
+	midi_writer out;         // the steps of the pattern
+	unsigned long long hash; // of the text in out
+	int pool_id;             // dedup: the first pattern with the same steps
+	int lowest_note;
+	int highest_note;
+	int lowest_po_index;
+	int highest_po_index;
+	midi_error error_code;
+} pattern_job;
+
+typedef struct {
+	const midi_song *song;
+	const midi_pixel_options *options;
+	int steps;               // per pattern
+	pattern_job *jobs;
+} pattern_bank;
+
+void midi_pixel_options_init(midi_pixel_options *options) {
+	options->steps_per_bar = 16;
+	options->bars = 2;
+	options->ppq = 0;
+	options->dedup = false;
+}
+
+int midi_pixel_key(int note, int base_note) {
+	static const int SCALE_KEY_ARR[12] = {0, 0, 1, 2, 2, 3, 3, 4, 5, 5, 6, 7};
+	if(note < base_note) return -1;
+	return (note - base_note) / 12 * 8 + SCALE_KEY_ARR[(note - base_note) % 12];
+}
+
+// 0 based step of an absolute tick, a bar is four quarter notes
+static int step_of_tick(const midi_pixel_options *options, unsigned int tick) {
+	return (int)((unsigned long long)tick * options->steps_per_bar / (4ULL * options->ppq));
+}
+
+// track 0 holds the global setup, unless the file has only the one track
+static bool is_note_track(const midi_song *song, int track) {
+	return track > 0 || song->format == 0;
+}
+
+static bool is_note_on(const midi_song *song, size_t e) {
+	return MIDI_STATUS_TABLE[song->status[e]].kind == MIDI_STATUS_CHANNEL && get_high_bits(song->status[e]) == NOTE_ON && song->data2[e] > 0;
+}
+
+// collects the instrument names of a track and counts the patterns its notes need
+static midi_error read_track(const midi_song *song, int track, int steps, const midi_pixel_options *options, track_info *info) {
+	const midi_song_track *t = &song->tracks[track];
+	const midi_song_payload *meta = song->meta + t->first_meta;
+	int last_step = -1;
+	for(size_t e = t->first_event; e < t->first_event + t->number_of_events; e++) {
+		if(song->status[e] == META_EVENT) {
+			int type = song->data1[e];
+			int meta_index = type < 128 ? META_EVENT_INDEX_ARR[type] : -1;
+			if(meta_index < 0) return MIDI_ERROR_UNKNOWN_EVENT;
+			if(type == INSTRUMENT_NAME && info->number_of_names < MAX_NAMES) info->names[info->number_of_names++] = meta;
+			meta++;
+		} else if(is_note_on(song, e)) {
+			last_step = step_of_tick(options, song->tick[e]);
+		}
+	}
+	// long tracks are split into as many patterns as their last note needs
+	info->number_of_patterns = is_note_track(song, track) && last_step >= 0 ? last_step / steps + 1 : 0;
+	return MIDI_OK;
+}
+
+static void write_pattern_header(midi_writer *w, const midi_song *song, const track_info *info, int track, int pattern) {
+	midi_writer_string(w, "\t\t{");
+	midi_writer_format(w, "\n\t\t\t\"track number\":%u,\n", track);
+	if(pattern >= 0) midi_writer_format(w, "\t\t\t\"pattern number\":%i,\n", pattern+1);
+	if(!is_note_track(song, track)) midi_writer_format(w, "\t\t\t\"className\": \"%s\",\n", "SETUP");
+	for(int name = 0; name < info->number_of_names; name++) {
+		const midi_song_payload *meta = info->names[name];
+		const unsigned char *meta_data = midi_song_payload_data(song, meta);
+		midi_writer_format(w, "\t\t\t\"className\": \"%.*s\",\n", (int)strnlen((const char *)meta_data, meta->length), meta_data);
+	}
+}
+
+// one slot per step, the first Note ON on a step takes it
+static void quantize_pattern(void *ctx, int index) {
+	pattern_bank *bank = ctx;
+	const midi_song *song = bank->song;
+	const midi_pixel_options *options = bank->options;
+	int steps = bank->steps;
+	pattern_job *job = &bank->jobs[index];
+	const midi_song_track *t = &song->tracks[job->track];
+	job->lowest_note = 128;
+	job->highest_note = 0;
+	job->lowest_po_index = 128;
+	job->highest_po_index = 0;
+
+	int *slots = malloc(steps * sizeof(int));
+	if(slots == NULL) {
+		job->error_code = MIDI_ERROR_OUT_OF_MEMORY;
+		return;
+	}
+	for(int step = 0; step < steps; step++) slots[step] = -1;
+
+	// rows are sorted by tick, find the first one of the pattern
+	int first_step = job->pattern * steps;
+	size_t low = t->first_event, high = t->first_event + t->number_of_events;
+	while(low < high) {
+		size_t middle = low + (high - low) / 2;
+		if(step_of_tick(options, song->tick[middle]) < first_step) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	for(size_t e = low; e < t->first_event + t->number_of_events; e++) {
+		int step = step_of_tick(options, song->tick[e]) - first_step;
+		if(step >= steps) break;
+		if(!is_note_on(song, e) || slots[step] >= 0) continue;
+		unsigned char key = song->data1[e];
+		slots[step] = key;
+		if(job->lowest_note > key) job->lowest_note = key;
+		if(job->highest_note < key) job->highest_note = key;
+	}
+
+	midi_writer *out = &job->out;
+	for(int step = 0; step < steps; step++) {
+		if(step > 0) midi_writer_string(out, ",\n");
+		if(slots[step] < 0) {
+			// nothing on this step
+			if(CLEAN) {
+				midi_writer_string(out, "\t\t\t\t{\"on\": 0, \"key\": ");
+				midi_writer_int(out, EMPTY);
+				midi_writer_char(out, '}');
+			} else {
+				midi_writer_format(out, "\t\t\t\t{\"on\": 0, \"key\": %i, \"step\": %i}", EMPTY, step+1);
+			}
+			continue;
+		}
+		// note on!
+		int po_index = midi_pixel_key(slots[step], BASE_NOTE);
+		if(po_index < 0) {
+			job->error_code = MIDI_ERROR_NOTE_TOO_LOW;
+			break;
+		}
+		if(job->lowest_po_index > po_index) job->lowest_po_index = po_index;
+		if(job->highest_po_index < po_index) job->highest_po_index = po_index;
+		if(CLEAN) {
+			midi_writer_string(out, "\t\t\t\t{\"on\": 1, \"key\": ");
+			midi_writer_int(out, po_index);
+			midi_writer_char(out, '}');
+		} else {
+			midi_writer_format(out, "\t\t\t\t{\"on\": 1, \"key\": %i, \"step\": %i}", po_index, step+1);
+		}
+	}
+	free(slots);
+	if(out->failed && job->error_code == MIDI_OK) job->error_code = MIDI_ERROR_OUT_OF_MEMORY;
+
+	// hash of the text, so equal patterns can be found without comparing them all
+	job->hash = midi_hash(out->data, out->len, MIDI_HASH_SEED);
+}
+
+// gives every job the pool id of the first job with the same steps, ids
+// count up in order of first appearance. pool gets the job of each id,
+// returns the number of ids or -1
+static int pool_patterns(pattern_job *jobs, int number_of_jobs, int *pool) {
+	// open addressing on the hash, at most half full
+	size_t size = 16;
+	while(size < (size_t)number_of_jobs * 2) size *= 2;
+	int *table = malloc(size * sizeof(int));
+	if(table == NULL) return -1;
+	for(size_t i = 0; i < size; i++) table[i] = -1;
+
+	int number_of_ids = 0;
+	for(int job = 0; job < number_of_jobs; job++) {
+		pattern_job *j = &jobs[job];
+		size_t slot = j->hash & (size - 1);
+		while(table[slot] >= 0) {
+			const pattern_job *first = &jobs[pool[table[slot]]];
+			if(first->hash == j->hash && first->out.len == j->out.len && memcmp(first->out.data, j->out.data, j->out.len) == 0) break;
+			slot = (slot + 1) & (size - 1);
+		}
+		if(table[slot] < 0) {
+			table[slot] = number_of_ids;
+			pool[number_of_ids++] = job;
+		}
+		j->pool_id = table[slot];
+	}
+	free(table);
+	return number_of_ids;
+}
+
+static int fail(midi_pixel_stats *stats, midi_error error) {
+	stats->error_code = error;
+	stats->error = midi_error_string(error);
+	return -1;
+}
+
+int midi_pixel_write(midi_writer *w, const midi_song *song, const char *name, const midi_pixel_options *options, midi_pixel_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+	stats->lowest_note = 128;
+	stats->lowest_po_index = 128;
+
+	// the grid follows the song's own resolution unless told otherwise
+	midi_pixel_options grid = *options;
+	if(grid.ppq == 0) grid.ppq = song->division & 0x8000 ? 480 : song->division;
+	if(grid.steps_per_bar <= 0 || grid.bars <= 0) return fail(stats, MIDI_ERROR_BAD_OPTION);
+	// a division of 0 is not a midi file
+	if(grid.ppq == 0) return fail(stats, MIDI_ERROR_NOT_MIDI);
+	int steps = grid.steps_per_bar * grid.bars;
+	int number_of_tracks = song->number_of_tracks;
+
+	// find the patterns of every track, then quantize them all in parallel
+	track_info *tracks = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(track_info));
+	if(tracks == NULL) return fail(stats, MIDI_ERROR_OUT_OF_MEMORY);
+	int number_of_patterns = 0;
+	for(int track = 0; track < number_of_tracks; track++) {
+		midi_error error = read_track(song, track, steps, &grid, &tracks[track]);
+		if(error != MIDI_OK) {
+			free(tracks);
+			return fail(stats, error);
+		}
+		tracks[track].first_pattern = number_of_patterns;
+		number_of_patterns += tracks[track].number_of_patterns;
+	}
+	pattern_job *jobs = calloc(number_of_patterns > 0 ? number_of_patterns : 1, sizeof(pattern_job));
+	int *pool = grid.dedup ? malloc((number_of_patterns > 0 ? number_of_patterns : 1) * sizeof(int)) : NULL;
+	midi_error error = jobs == NULL || (grid.dedup && pool == NULL) ? MIDI_ERROR_OUT_OF_MEMORY : MIDI_OK;
+	int number_of_jobs = 0;
+	for(int track = 0; track < number_of_tracks && error == MIDI_OK; track++) {
+		for(int pattern = 0; pattern < tracks[track].number_of_patterns; pattern++) {
+			pattern_job *job = &jobs[number_of_jobs];
+			job->track = track;
+			job->pattern = pattern;
+			if(midi_writer_init(&job->out, -1) < 0) {
+				error = MIDI_ERROR_OUT_OF_MEMORY;
+				break;
+			}
+			number_of_jobs++;
+		}
+	}
+	if(error == MIDI_OK) {
+		pattern_bank bank = { .song = song, .options = &grid, .steps = steps, .jobs = jobs };
+		midi_parallel_for(number_of_patterns, 0, quantize_pattern, &bank);
+	}
+	for(int job = 0; job < number_of_jobs && error == MIDI_OK; job++) {
+		pattern_job *j = &jobs[job];
+		error = j->error_code;
+		if(stats->lowest_note > j->lowest_note) stats->lowest_note = j->lowest_note;
+		if(stats->highest_note < j->highest_note) stats->highest_note = j->highest_note;
+		if(stats->lowest_po_index > j->lowest_po_index) stats->lowest_po_index = j->lowest_po_index;
+		if(stats->highest_po_index < j->highest_po_index) stats->highest_po_index = j->highest_po_index;
+	}
+	stats->number_of_patterns = number_of_patterns;
+	stats->number_of_unique = number_of_patterns;
+	// dedup: every distinct pattern goes into the pool once, tracks list pool ids
+	if(error == MIDI_OK && grid.dedup) {
+		stats->number_of_unique = pool_patterns(jobs, number_of_patterns, pool);
+		if(stats->number_of_unique < 0) error = MIDI_ERROR_OUT_OF_MEMORY;
+	}
+
+	if(error == MIDI_OK) {
+		midi_writer_string(w, "{\n\t\"info\": \"converted using midi2json by superpanic, https://github.com/superpanic\",\n");
+		midi_writer_format(w, "\t\"name\": \"%s\",\n", name);
+		if(grid.dedup) {
+			midi_writer_string(w, "\t\"pool\": [\n");
+			for(int id = 0; id < stats->number_of_unique; id++) {
+				if(id > 0) midi_writer_string(w, ",\n");
+				midi_writer_format(w, "\t\t{\n\t\t\t\"id\":%i,\n\t\t\t\"steps\":[\n", id);
+				midi_writer_append(w, &jobs[pool[id]].out);
+				midi_writer_string(w, "\n\t\t\t]\n\t\t}");
+			}
+			midi_writer_string(w, "\n\t],\n\t\"tracks\": [\n");
+			for(int track = 0; track < number_of_tracks; track++) {
+				const track_info *info = &tracks[track];
+				if(track > 0) midi_writer_string(w, ",\n");
+				write_pattern_header(w, song, info, track, -1);
+				midi_writer_string(w, "\t\t\t\"pattern ids\":[");
+				for(int pattern = 0; pattern < info->number_of_patterns; pattern++) {
+					if(pattern > 0) midi_writer_string(w, ", ");
+					midi_writer_int(w, jobs[info->first_pattern + pattern].pool_id);
+				}
+				midi_writer_string(w, "]\n\t\t}");
+			}
+		} else {
+			midi_writer_string(w, "\t\"patterns\": [\n");
+			// stitch the patterns together in track order
+			for(int track = 0; track < number_of_tracks; track++) {
+				const track_info *info = &tracks[track];
+				if(track > 0) midi_writer_string(w, ",\n");
+				if(info->number_of_patterns == 0) {
+					write_pattern_header(w, song, info, track, -1);
+					midi_writer_string(w, "\t\t\t\"steps\":[]\n\t\t}");
+					continue;
+				}
+				for(int pattern = 0; pattern < info->number_of_patterns; pattern++) {
+					if(pattern > 0) midi_writer_string(w, ",\n");
+					write_pattern_header(w, song, info, track, pattern);
+					midi_writer_string(w, "\t\t\t\"steps\":[\n");
+					midi_writer_append(w, &jobs[info->first_pattern + pattern].out);
+					midi_writer_string(w, "\n\t\t\t]\n\t\t}");
+				}
+			}
+		}
+		midi_writer_string(w, "\n\t],");
+		midi_writer_format(w, "\n\t\"number of tracks\": %i,", number_of_tracks-1);
+		midi_writer_format(w, "\n\t\"number of patterns\": %i,", number_of_patterns);
+		if(grid.dedup) midi_writer_format(w, "\n\t\"unique patterns\": %i,", stats->number_of_unique);
+		midi_writer_format(w, "\n\t\"steps per pattern\": %i,", steps);
+		midi_writer_format(w, "\n\t\"lowest midi note\": %i,", stats->lowest_note);
+		midi_writer_format(w, "\n\t\"highest midi note\": %i,", stats->highest_note);
+		midi_writer_format(w, "\n\t\"lowest po index\": %i,", stats->lowest_po_index);
+		midi_writer_format(w, "\n\t\"highest po index\": %i", stats->highest_po_index);
+		midi_writer_string(w, "\n}");
+	}
+
+	for(int job = 0; job < number_of_jobs; job++) midi_writer_free(&jobs[job].out);
+	free(pool);
+	free(jobs);
+	free(tracks);
+	if(error != MIDI_OK) return fail(stats, error);
+	stats->error = midi_error_string(MIDI_OK);
+	return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef MIDI_PIXEL_H
+#define MIDI_PIXEL_H
+
+#include <stdbool.h>
+
+#include "midi_common.h"
+#include "midi_song.h"
+#include "midi_writer.h"
+
+// Pocket Operator pixel patterns of a song: the Note ONs of every track
+// quantized onto a step grid, one pattern per bars bars. Tracks longer than
+// one pattern are split into consecutive patterns, which are quantized in
+// parallel. The first Note ON on a step takes it.
+
+typedef struct {
+	int steps_per_bar;       // grid resolution, 16 = sixteenth notes
+	int bars;                // bars per pattern
+	unsigned int ppq;        // ticks per quarter note the grid is laid on, 0: the division of the song
+	bool dedup;              // write every distinct pattern once to a pool, tracks list pool ids
+} midi_pixel_options;
+
+typedef struct {
+	int number_of_patterns;
+	int number_of_unique;    // with dedup, else number_of_patterns
+	int lowest_note;
+	int highest_note;
+	int lowest_po_index;
+	int highest_po_index;
+
+	midi_error error_code;
+	const char *error;       // midi_error_string(error_code)
+} midi_pixel_stats;
+
+// 16 steps per bar, 2 bars per pattern, the song's own division, no pool
+void midi_pixel_options_init(midi_pixel_options *options);
+
+// writes the pattern json of song to w, name goes into the "name" field.
+// Returns 0, or -1 with stats->error_code set
+int midi_pixel_write(midi_writer *w, const midi_song *song, const char *name, const midi_pixel_options *options, midi_pixel_stats *stats);
+
+// pixel key of a midi note, 8 keys per octave from base_note up, -1 below it
+int midi_pixel_key(int note, int base_note);
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "midi_reader.h"
+
+const size_t BULK_READ_CHUNK = 1 << 20;
+
+static int read_all(midi_reader *r, int fd) {
+	unsigned char *buffer = NULL;
+	size_t capacity = 0;
+	size_t size = 0;
+	for(;;) {
+		if(size == capacity) {
+			capacity = capacity ? capacity * 2 : BULK_READ_CHUNK;
+			unsigned char *grown = realloc(buffer, capacity);
+			if(grown == NULL) {
+				free(buffer);
+				return -1;
+			}
+			buffer = grown;
+		}
+		ssize_t n = read(fd, buffer + size, capacity - size);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			free(buffer);
+			return -1;
+		}
+		if(n == 0) break;
+		size += n;
+	}
+	r->data = buffer;
+	r->size = size;
+	r->is_mapped = false;
+	return 0;
+}
+
+int midi_reader_open(midi_reader *r, const char *filename) {
+	memset(r, 0, sizeof(*r));
+
+	bool is_stdin = strcmp(filename, "-") == 0;
+	int fd = is_stdin ? STDIN_FILENO : open(filename, O_RDONLY);
+	if(fd < 0) return -1;
+
+	struct stat st;
+	if(fstat(fd, &st) < 0) {
+		if(!is_stdin) close(fd);
+		return -1;
+	}
+
+	int result = 0;
+	if(S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(map == MAP_FAILED) {
+			result = read_all(r, fd);
+		} else {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			r->data = map;
+			r->size = st.st_size;
+			r->is_mapped = true;
+		}
+	} else {
+		result = read_all(r, fd);
+	}
+
+	if(!is_stdin) close(fd);
+	return result;
+}
+
+// true for stdin ("-"), pipes and other inputs that can't be mapped
+bool midi_reader_is_stream(const char *filename) {
+	if(strcmp(filename, "-") == 0) return true;
+	struct stat st;
+	if(stat(filename, &st) < 0) return false;
+	return !S_ISREG(st.st_mode);
+}
+
+void midi_reader_close(midi_reader *r) {
+	if(r->is_mapped) {
+		munmap((void *)r->data, r->size);
+	} else {
+		free((void *)r->data);
+	}
+	memset(r, 0, sizeof(*r));
+}
+
+// Walks the chunk list from the current position using the 4 byte chunk
+// lengths and records the body of every MTrk chunk, other chunk types are
+// skipped. A chunk running past the end of the input is cut short at the
+// end. Returns the number of tracks found.
+int midi_reader_find_tracks(const midi_reader *r, midi_track_chunk *tracks, int max_tracks) {
+	int found = 0;
+	size_t pos = r->pos;
+	while(found < max_tracks && pos < r->size && r->size - pos >= 8) {
+		const unsigned char *p = r->data + pos;
+		size_t length = ((size_t)p[4] << 24) | ((size_t)p[5] << 16) | ((size_t)p[6] << 8) | p[7];
+		pos += 8;
+		if(length > r->size - pos) length = r->size - pos;
+		if(memcmp(p, "MTrk", 4) == 0) {
+			tracks[found].offset = pos;
+			tracks[found].length = length;
+			found++;
+		}
+		pos += length;
+	}
+	return found;
+}
@@ -0,0 +1,62 @@
+#ifndef MIDI_READER_H
+#define MIDI_READER_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Input cursor over a whole midi file held in memory. Regular files are
+// mmap'ed read only, pipes and other non-regular files (or "-" for stdin)
+// are pulled in with one bulk read. Decoding works straight on the bytes.
+typedef struct {
+	const unsigned char *data;
+	size_t size;
+	size_t pos;
+	bool is_mapped;
+} midi_reader;
+
+// location of one MTrk chunk body inside the input
+typedef struct {
+	size_t offset;
+	size_t length;
+} midi_track_chunk;
+
+int midi_reader_open(midi_reader *r, const char *filename);
+void midi_reader_close(midi_reader *r);
+bool midi_reader_is_stream(const char *filename);
+int midi_reader_find_tracks(const midi_reader *r, midi_track_chunk *tracks, int max_tracks);
+
+static inline bool midi_reader_eof(const midi_reader *r) {
+	return r->pos >= r->size;
+}
+
+// next byte, or EOF when the input is exhausted
+static inline int midi_reader_byte(midi_reader *r) {
+	if(r->pos >= r->size) return EOF;
+	return r->data[r->pos++];
+}
+
+// pointer to the next len bytes (no copy), or NULL if fewer are left
+static inline const unsigned char *midi_reader_bytes(midi_reader *r, size_t len) {
+	if(len > r->size - r->pos) return NULL;
+	const unsigned char *p = r->data + r->pos;
+	r->pos += len;
+	return p;
+}
+
+// big endian values as stored in the midi headers, false on end of input
+static inline bool midi_reader_u32(midi_reader *r, unsigned int *value) {
+	const unsigned char *p = midi_reader_bytes(r, 4);
+	if(p == NULL) return false;
+	*value = ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+	return true;
+}
+
+static inline bool midi_reader_u16(midi_reader *r, unsigned short *value) {
+	const unsigned char *p = midi_reader_bytes(r, 2);
+	if(p == NULL) return false;
+	*value = (unsigned short)((p[0] << 8) | p[1]);
+	return true;
+}
+
+#endif
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "midi_common.h"
+#include "midi_rf.h"
+
+enum {
+	INSTRUMENT_NAME = 0x03
+};
+
+// the steps of one grid for the track being written
+typedef struct {
+	midi_writer steps;
+	int step;                // last step written, 1 based
+	bool is_first_step;
+} grid_steps;
+
+void midi_rf_options_init(midi_rf_options *options) {
+	memset(options, 0, sizeof(*options));
+	midi_rf_parse_grids(options, "16");
+}
+
+int midi_rf_parse_grids(midi_rf_options *options, const char *list) {
+	int number_of_grids = 0;
+	while(*list) {
+		char *end;
+		long value = strtol(list, &end, 10);
+		if(end == list || value <= 0 || value > 1024 || number_of_grids == MIDI_RF_MAX_GRIDS) return -1;
+		midi_rf_grid *grid = &options->grids[number_of_grids++];
+		grid->steps_per_bar = (int)value;
+		if(*end == 't') {
+			if(value % 2) return -1;
+			grid->steps_per_bar = (int)value * 3 / 2;
+			end++;
+		}
+		snprintf(grid->name, sizeof(grid->name), "%.*s", (int)(end - list), list);
+		if(*end == ',') {
+			end++;
+		} else if(*end) {
+			return -1;
+		}
+		list = end;
+	}
+	if(number_of_grids == 0) return -1;
+	options->number_of_grids = number_of_grids;
+	return 0;
+}
+
+static void write_step(grid_steps *grid, bool on, unsigned int key, int step) {
+	if(!grid->is_first_step) midi_writer_string(&grid->steps, ",\n");
+	grid->is_first_step = false;
+	midi_writer_string(&grid->steps, on ? "\t\t\t\t{\"on\": 1, \"key\": " : "\t\t\t\t{\"on\": 0, \"key\": ");
+	midi_writer_uint(&grid->steps, key);
+	midi_writer_string(&grid->steps, ", \"step\": ");
+	midi_writer_int(&grid->steps, step);
+	midi_writer_char(&grid->steps, '}');
+}
+
+int midi_rf_write(midi_writer *w, const midi_song *song, const char *name, const midi_rf_options *options) {
+	// the grid follows the song's own resolution unless told otherwise
+	unsigned int ppq = options->ppq;
+	if(ppq == 0) ppq = song->division & 0x8000 ? 480 : song->division;
+	if(ppq == 0) return -1;
+	int number_of_grids = options->number_of_grids;
+	grid_steps grids[MIDI_RF_MAX_GRIDS];
+	for(int g = 0; g < number_of_grids; g++) {
+		if(midi_writer_init(&grids[g].steps, -1) < 0) {
+			while(g-- > 0) midi_writer_free(&grids[g].steps);
+			return -1;
+		}
+	}
+
+	midi_writer_string(w, "{\n\t\"info\": \"converted using midi2json by superpanic, https://github.com/superpanic\",\n");
+	midi_writer_format(w, "\t\"name\": \"%s\",\n", name);
+	midi_writer_string(w, "\t\"patterns\": [\n");
+
+	bool failed = false;
+	for(int track = 0; track < song->number_of_tracks; track++) {
+		const midi_song_track *t = &song->tracks[track];
+		// track 0 holds the global setup, unless it is the only track
+		bool is_note_track = track > 0 || song->format == 0;
+
+		if(track > 0) midi_writer_string(w, ",\n");
+		midi_writer_string(w, "\t\t{");
+		midi_writer_format(w, "\n\t\t\t\"track number\":%u,\n", track);
+		if(!is_note_track) midi_writer_format(w, "\t\t\t\"className\": \"%s\",\n", "SETUP");
+
+		for(int g = 0; g < number_of_grids; g++) {
+			grids[g].steps.len = 0;
+			grids[g].step = 0;
+			grids[g].is_first_step = true;
+		}
+		bool has_notes = false;
+
+		// one pass over the events feeds every grid, meta payloads are picked up in row order
+		const midi_song_payload *meta = song->meta + t->first_meta;
+		for(size_t e = t->first_event; e < t->first_event + t->number_of_events; e++) {
+			int command_byte = song->status[e];
+			if(command_byte == META_EVENT) {
+				int type = song->data1[e];
+				const char *meta_data = (const char *)midi_song_payload_data(song, meta);
+				if(type == INSTRUMENT_NAME) {
+					midi_writer_format(w, "\t\t\t\"className\": \"%.*s\",\n", (int)strnlen(meta_data, meta->length), meta_data);
+				}
+				meta++;
+			} else if(is_note_track && get_high_bits(command_byte) == NOTE_ON && song->data2[e] > 0) {
+				has_notes = true;
+				for(int g = 0; g < number_of_grids; g++) {
+					grid_steps *grid = &grids[g];
+					int current_step = (int)((unsigned long long)song->tick[e] * options->grids[g].steps_per_bar / (4ULL * ppq)) + 1;
+					while(grid->step + 1 < current_step) write_step(grid, false, 0, ++grid->step);
+					write_step(grid, true, song->data1[e], current_step);
+					grid->step = current_step;
+				}
+			}
+		}
+
+		if(!has_notes) {
+			midi_writer_string(w, "\t\t\t\"steps\":[]\n\t\t}");
+			continue;
+		}
+		for(int g = 0; g < number_of_grids; g++) {
+			grid_steps *grid = &grids[g];
+			// fill up the first bar
+			while(grid->step < options->grids[g].steps_per_bar) write_step(grid, false, 0, ++grid->step);
+			if(number_of_grids == 1) {
+				midi_writer_string(w, "\t\t\t\"steps\":[\n");
+			} else {
+				midi_writer_format(w, "\t\t\t\"steps 1/%s\":[\n", options->grids[g].name);
+			}
+			failed |= grid->steps.failed;
+			midi_writer_append(w, &grid->steps);
+			midi_writer_string(w, g < number_of_grids - 1 ? "\n\t\t\t],\n" : "\n\t\t\t]\n\t\t}");
+		}
+	}
+	midi_writer_string(w, "\n\t]\n}");
+
+	for(int g = 0; g < number_of_grids; g++) midi_writer_free(&grids[g].steps);
+	return failed ? -1 : 0;
+}
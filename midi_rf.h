@@ -0,0 +1,35 @@
+#ifndef MIDI_RF_H
+#define MIDI_RF_H
+
+#include "midi_common.h"
+#include "midi_song.h"
+#include "midi_writer.h"
+
+// Note ONs of every track as numbered steps, for the rhythm game. One pass
+// over the events of a track places every Note ON on all grids at once.
+
+#define MIDI_RF_MAX_GRIDS 8
+
+typedef struct {
+	int steps_per_bar;       // 16 = sixteenth notes, 12 = eighth note triplets
+	char name[16];           // as given, "16" or "8t"
+} midi_rf_grid;
+
+typedef struct {
+	midi_rf_grid grids[MIDI_RF_MAX_GRIDS];
+	int number_of_grids;
+	unsigned int ppq;        // ticks per quarter note the grids are laid on, 0: the division of the song
+} midi_rf_options;
+
+// one sixteenth note grid, the song's own division
+void midi_rf_options_init(midi_rf_options *options);
+// "8,16,32,8t": steps per bar, a trailing t makes it triplets (3 steps
+// where there were 2). Returns -1 if the list is malformed
+int midi_rf_parse_grids(midi_rf_options *options, const char *list);
+
+// writes the step json of song to w, name goes into the "name" field. With
+// one grid every track has "steps", with several one "steps 1/N" per grid.
+// Returns 0, -1 when out of memory or the song has no ticks per quarter note
+int midi_rf_write(midi_writer *w, const midi_song *song, const char *name, const midi_rf_options *options);
+
+#endif
@@ -0,0 +1,44 @@
+#include "midi_common.h"
+#include "midi_reader.h"
+#include "midi_parser.h"
+#include "midi_sax.h"
+
+typedef struct {
+	const midi_sax_handler *handler;
+	void *user;
+	int tracks;
+} sax_state;
+
+static int dispatch(void *user, const midi_event *ev) {
+	sax_state *s = user;
+	const midi_sax_handler *h = s->handler;
+	int (*on_event)(void *user, const midi_event *event) = NULL;
+	switch(ev->kind) {
+	case MIDI_EVENT_HEADER:      on_event = h->on_header; break;
+	case MIDI_EVENT_TRACK_BEGIN: on_event = h->on_track_begin; s->tracks++; break;
+	case MIDI_EVENT_CHANNEL:     on_event = h->on_channel_event; break;
+	case MIDI_EVENT_META:        on_event = h->on_meta; break;
+	case MIDI_EVENT_SYSEX:       on_event = h->on_sysex; break;
+	case MIDI_EVENT_TRACK_END:   on_event = h->on_track_end; break;
+	}
+	return on_event ? on_event(s->user, ev) : 0;
+}
+
+midi_error midi_sax_parse(const unsigned char *data, size_t size, const midi_sax_handler *handler, void *user) {
+	sax_state s = { .handler = handler, .user = user };
+	midi_parser parser;
+	midi_parser_init(&parser, dispatch, &s);
+	// the whole input is one slice, so payloads are never copied
+	if(midi_parser_feed(&parser, data, size) == 0) midi_parser_finish(&parser);
+	midi_parser_free(&parser);
+	if(parser.error_code == MIDI_OK && s.tracks < parser.event.number_of_tracks) return MIDI_ERROR_NO_TRACK;
+	return parser.error_code;
+}
+
+midi_error midi_sax_parse_file(const char *filename, const midi_sax_handler *handler, void *user) {
+	midi_reader in;
+	if(midi_reader_open(&in, filename) < 0) return MIDI_ERROR_FILE_NOT_FOUND;
+	midi_error result = midi_sax_parse(in.data, in.size, handler, user);
+	midi_reader_close(&in);
+	return result;
+}
@@ -0,0 +1,27 @@
+#ifndef MIDI_SAX_H
+#define MIDI_SAX_H
+
+#include <stddef.h>
+
+#include "midi_common.h"
+#include "midi_parser.h"
+
+// Callback interface for embedding the decoder in a long running process.
+// Every handler is optional (NULL skips the event) and gets the parser's
+// midi_event, whose payload points straight into the input. Returning
+// anything but 0 from a handler stops the parse with MIDI_ERROR_STOPPED.
+// Nothing is allocated per event and nothing ever exits the process.
+typedef struct {
+	int (*on_header)(void *user, const midi_event *event);
+	int (*on_track_begin)(void *user, const midi_event *event);
+	int (*on_channel_event)(void *user, const midi_event *event);
+	int (*on_meta)(void *user, const midi_event *event);
+	int (*on_sysex)(void *user, const midi_event *event);
+	int (*on_track_end)(void *user, const midi_event *event);
+} midi_sax_handler;
+
+// both return MIDI_OK or the error that ended the parse
+midi_error midi_sax_parse(const unsigned char *data, size_t size, const midi_sax_handler *handler, void *user);
+midi_error midi_sax_parse_file(const char *filename, const midi_sax_handler *handler, void *user);
+
+#endif
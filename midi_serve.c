@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "midi_common.h"
+#include "midi_serve.h"
+
+enum {
+	REQUEST_HEADER_SIZE = 36,
+	RESPONSE_HEADER_SIZE = 28,
+	NAME_MAX_LENGTH = 4096   // for the name and the path
+};
+
+static const char REQUEST_MAGIC[4] = { 'M', '2', 'J', 'Q' };
+static const char RESPONSE_MAGIC[4] = { 'M', '2', 'J', 'R' };
+
+static void put_u32(unsigned char *p, unsigned int value) {
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static void put_u64(unsigned char *p, unsigned long long value) {
+	put_u32(p, (unsigned int)value);
+	put_u32(p + 4, (unsigned int)(value >> 32));
+}
+
+static unsigned int get_u32(const unsigned char *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+static unsigned long long get_u64(const unsigned char *p) {
+	return get_u32(p) | (unsigned long long)get_u32(p + 4) << 32;
+}
+
+static int socket_address(struct sockaddr_un *address, const char *path) {
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(address->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(address->sun_path, path);
+	return 0;
+}
+
+int midi_serve_connect(const char *path) {
+	struct sockaddr_un address;
+	if(socket_address(&address, path) < 0) return -1;
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0) return -1;
+	if(connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return fd;
+}
+
+int midi_serve_listen(const char *path) {
+	struct sockaddr_un address;
+	if(socket_address(&address, path) < 0) return -1;
+	struct stat st;
+	if(lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		// left behind by a server that is gone, unless one still answers on it
+		int other = midi_serve_connect(path);
+		if(other >= 0) {
+			close(other);
+			errno = EADDRINUSE;
+			return -1;
+		}
+		unlink(path);
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd < 0) return -1;
+	if(bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	errno = 0;
+	return fd;
+}
+
+// the pieces go out in as few calls as the socket takes, a peer that went away is an error, not a SIGPIPE
+static int send_all(int fd, struct iovec *iov, int count) {
+	while(count > 0) {
+		struct msghdr message = { .msg_iov = iov, .msg_iovlen = count };
+		ssize_t n = sendmsg(fd, &message, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return -1;
+		while(count > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *data, size_t size) {
+	char *p = data;
+	while(size > 0) {
+		ssize_t n = recv(fd, p, size, 0);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return -1;
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+// reads size bytes into *buffer, growing it to size + 1 for the terminating 0
+static int read_into(int fd, void **buffer, size_t *capacity, size_t size) {
+	if(size + 1 > *capacity) {
+		void *grown = realloc(*buffer, size + 1);
+		if(grown == NULL) return -1;
+		*buffer = grown;
+		*capacity = size + 1;
+	}
+	((char *)*buffer)[size] = '\0';
+	return read_all(fd, *buffer, size);
+}
+
+int midi_serve_read_request(int fd, midi_serve_request *r) {
+	unsigned char header[REQUEST_HEADER_SIZE];
+	if(read_all(fd, header, sizeof(header)) < 0) return -1;
+	if(memcmp(header, REQUEST_MAGIC, 4) != 0 || get_u32(header + 4) != MIDI_SERVE_VERSION) return -1;
+	r->flags = get_u32(header + 8);
+	r->layout = get_u32(header + 12);
+	r->note_order = get_u32(header + 16);
+	size_t name_length = get_u32(header + 20);
+	size_t path_length = get_u32(header + 24);
+	unsigned long long data_size = get_u64(header + 28);
+	if(name_length > NAME_MAX_LENGTH || path_length > NAME_MAX_LENGTH || data_size > SIZE_MAX - 1) return -1;
+	r->data_size = data_size;
+	if(read_into(fd, (void **)&r->name, &r->name_capacity, name_length) < 0) return -1;
+	if(read_into(fd, (void **)&r->path, &r->path_capacity, path_length) < 0) return -1;
+	return read_into(fd, (void **)&r->data, &r->data_capacity, r->data_size);
+}
+
+void midi_serve_request_free(midi_serve_request *r) {
+	free(r->name);
+	free(r->path);
+	free(r->data);
+	memset(r, 0, sizeof(*r));
+}
+
+int midi_serve_send_request(int fd, const midi_serve_request *r) {
+	const char *path = r->path != NULL ? r->path : "";
+	unsigned char header[REQUEST_HEADER_SIZE];
+	memcpy(header, REQUEST_MAGIC, 4);
+	put_u32(header + 4, MIDI_SERVE_VERSION);
+	put_u32(header + 8, r->flags);
+	put_u32(header + 12, r->layout);
+	put_u32(header + 16, r->note_order);
+	put_u32(header + 20, strlen(r->name));
+	put_u32(header + 24, strlen(path));
+	put_u64(header + 28, r->data_size);
+	struct iovec iov[4] = {
+		{ header, sizeof(header) },
+		{ r->name, strlen(r->name) },
+		{ (char *)path, strlen(path) },
+		{ r->data, r->data_size }
+	};
+	return send_all(fd, iov, 4);
+}
+
+int midi_serve_send_response(int fd, unsigned int status, const char *log, size_t log_size, const char *body, size_t body_size) {
+	unsigned char header[RESPONSE_HEADER_SIZE];
+	memcpy(header, RESPONSE_MAGIC, 4);
+	put_u32(header + 4, MIDI_SERVE_VERSION);
+	put_u32(header + 8, status);
+	put_u64(header + 12, log_size);
+	put_u64(header + 20, body_size);
+	struct iovec iov[3] = {
+		{ header, sizeof(header) },
+		{ (char *)log, log_size },
+		{ (char *)body, body_size }
+	};
+	return send_all(fd, iov, 3);
+}
+
+int midi_serve_read_response(int fd, midi_serve_response *r) {
+	memset(r, 0, sizeof(*r));
+	unsigned char header[RESPONSE_HEADER_SIZE];
+	if(read_all(fd, header, sizeof(header)) < 0) return -1;
+	if(memcmp(header, RESPONSE_MAGIC, 4) != 0 || get_u32(header + 4) != MIDI_SERVE_VERSION) return -1;
+	r->status = get_u32(header + 8);
+	unsigned long long log_size = get_u64(header + 12);
+	unsigned long long body_size = get_u64(header + 20);
+	if(log_size > SIZE_MAX - 1 || body_size > SIZE_MAX - 1) return -1;
+	size_t log_capacity = 0, body_capacity = 0;
+	r->log_size = log_size;
+	r->body_size = body_size;
+	if(read_into(fd, (void **)&r->log, &log_capacity, r->log_size) < 0) return -1;
+	return read_into(fd, (void **)&r->body, &body_capacity, r->body_size);
+}
+
+void midi_serve_response_free(midi_serve_response *r) {
+	free(r->log);
+	free(r->body);
+	memset(r, 0, sizeof(*r));
+}
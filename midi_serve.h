@@ -0,0 +1,74 @@
+#ifndef MIDI_SERVE_H
+#define MIDI_SERVE_H
+
+#include <stddef.h>
+
+// Requests and responses of the conversion server (midi2json --serve) on a
+// Unix domain socket. A connection carries any number of requests, each
+// answered before the next one is read. Numbers are little endian.
+//
+// request:  "M2JQ", version u32, flags u32, layout u32, note order u32,
+//           name length u32, path length u32, data length u64,
+//           name, path, data
+// response: "M2JR", version u32, status u32, log length u64, body length u64,
+//           log, body
+//
+// name is the input name written into the output. The server reads the
+// midi-file at path, or converts the data sent along when path is empty.
+// The body is the output, or the error message when status is not 0.
+
+#define MIDI_SERVE_VERSION 1
+
+typedef enum {
+	MIDI_SERVE_BIN = 1 << 0,             // the binary layout instead of json
+	MIDI_SERVE_ABSOLUTE_TIME = 1 << 1,
+	MIDI_SERVE_SHORTEST_FLOATS = 1 << 2
+} midi_serve_flag;
+
+// the json layouts, as midi2json --layout and --notes pick them
+typedef enum {
+	MIDI_SERVE_ROWS,
+	MIDI_SERVE_COLUMNS,
+	MIDI_SERVE_NOTES
+} midi_serve_layout;
+
+typedef struct {
+	unsigned int flags;
+	unsigned int layout;     // midi_serve_layout
+	unsigned int note_order; // midi_notes_order
+	char *name;
+	char *path;              // empty when the data is sent along
+	unsigned char *data;
+	size_t data_size;
+
+	// kept from request to request by midi_serve_read_request
+	size_t name_capacity;
+	size_t path_capacity;
+	size_t data_capacity;
+} midi_serve_request;
+
+typedef struct {
+	unsigned int status;     // 0 ok, the body is the output
+	char *log;
+	size_t log_size;
+	char *body;
+	size_t body_size;
+} midi_serve_response;
+
+// socket at path for the server, a stale socket file left there is replaced. -1 with errno set
+int midi_serve_listen(const char *path);
+// -1 with errno set
+int midi_serve_connect(const char *path);
+
+// read_request returns 0, or -1 when the connection closed or sent something
+// else. The buffers of r grow as needed and are freed by midi_serve_request_free
+int midi_serve_read_request(int fd, midi_serve_request *r);
+void midi_serve_request_free(midi_serve_request *r);
+int midi_serve_send_request(int fd, const midi_serve_request *r);
+
+int midi_serve_send_response(int fd, unsigned int status, const char *log, size_t log_size, const char *body, size_t body_size);
+// the log and body are allocated, midi_serve_response_free frees them
+int midi_serve_read_response(int fd, midi_serve_response *r);
+void midi_serve_response_free(midi_serve_response *r);
+
+#endif
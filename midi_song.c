@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_common.h"
+#include "midi_reader.h"
+#include "midi_parallel.h"
+#include "midi_song.h"
+
+typedef struct {
+	midi_song *parts; // one partial song per track, decoded independently
+	const unsigned char *data;
+	const midi_track_chunk *chunks;
+	const bool *decode;      // tracks left out by the filter stay empty
+	midi_song *song;
+} song_load;
+
+void midi_song_init(midi_song *song) {
+	memset(song, 0, sizeof(*song));
+}
+
+void midi_song_free(midi_song *song) {
+	free(song->tick);
+	free(song->status);
+	free(song->data1);
+	free(song->data2);
+	free(song->track);
+	free(song->tracks);
+	free(song->meta);
+	free(song->sysex);
+	free(song->payload_pool);
+	midi_song_init(song);
+}
+
+static int fail(midi_song *song, midi_error code) {
+	song->error_code = code;
+	song->error = midi_error_string(code);
+	return -1;
+}
+
+static void *grow(void *array, size_t *capacity, size_t needed, size_t element_size) {
+	if(needed <= *capacity) return array;
+	size_t new_capacity = *capacity ? *capacity : 1024;
+	while(new_capacity < needed) new_capacity *= 2;
+	void *grown = realloc(array, new_capacity * element_size);
+	if(grown != NULL) *capacity = new_capacity;
+	return grown;
+}
+
+static int reserve_events(midi_song *song, size_t needed) {
+	if(needed <= song->event_capacity) return 0;
+	size_t capacity = song->event_capacity ? song->event_capacity : 1024;
+	while(capacity < needed) capacity *= 2;
+	unsigned int *tick = realloc(song->tick, capacity * sizeof(*tick));
+	if(tick) song->tick = tick;
+	unsigned char *status = realloc(song->status, capacity);
+	if(status) song->status = status;
+	unsigned char *data1 = realloc(song->data1, capacity);
+	if(data1) song->data1 = data1;
+	unsigned char *data2 = realloc(song->data2, capacity);
+	if(data2) song->data2 = data2;
+	unsigned short *track = realloc(song->track, capacity * sizeof(*track));
+	if(track) song->track = track;
+	if(!tick || !status || !data1 || !data2 || !track) return -1;
+	song->event_capacity = capacity;
+	return 0;
+}
+
+static int add_payload(midi_song *song, midi_song_payload **table, size_t *count, size_t *capacity, size_t event, const unsigned char *data, size_t length) {
+	midi_song_payload *grown = grow(*table, capacity, *count + 1, sizeof(midi_song_payload));
+	if(grown == NULL) return -1;
+	*table = grown;
+	if(length > 0) {
+		// an empty pool stays NULL until the first payload with data
+		unsigned char *pool = grow(song->payload_pool, &song->payload_pool_capacity, song->payload_pool_size + length, 1);
+		if(pool == NULL) return -1;
+		song->payload_pool = pool;
+	}
+
+	midi_song_payload *payload = &(*table)[(*count)++];
+	payload->event = event;
+	payload->offset = song->payload_pool_size;
+	payload->length = length;
+	if(length > 0) memcpy(song->payload_pool + song->payload_pool_size, data, length);
+	song->payload_pool_size += length;
+	return 0;
+}
+
+// parser callback appending every event of one track as a row
+static int append_event(void *user, const midi_event *ev) {
+	midi_song *song = user;
+	if(ev->kind != MIDI_EVENT_CHANNEL && ev->kind != MIDI_EVENT_META && ev->kind != MIDI_EVENT_SYSEX) return 0;
+
+	size_t row = song->number_of_events;
+	if(reserve_events(song, row + 1) < 0) return fail(song, MIDI_ERROR_OUT_OF_MEMORY);
+	song->tick[row] = ev->tick;
+	song->status[row] = ev->status;
+	song->data1[row] = ev->kind == MIDI_EVENT_META ? ev->type : ev->data[0];
+	song->data2[row] = ev->kind == MIDI_EVENT_CHANNEL ? ev->data[1] : 0;
+	song->track[row] = ev->track;
+	song->number_of_events++;
+
+	int result = 0;
+	if(ev->kind == MIDI_EVENT_META) {
+		result = add_payload(song, &song->meta, &song->number_of_meta, &song->meta_capacity, row, ev->payload, ev->payload_len);
+	} else if(ev->kind == MIDI_EVENT_SYSEX) {
+		result = add_payload(song, &song->sysex, &song->number_of_sysex, &song->sysex_capacity, row, ev->payload, ev->payload_len);
+	}
+	if(result < 0) return fail(song, MIDI_ERROR_OUT_OF_MEMORY);
+	return 0;
+}
+
+static void decode_track(void *ctx, int track) {
+	song_load *load = ctx;
+	midi_song *part = &load->parts[track];
+	const midi_track_chunk *chunk = &load->chunks[track];
+	if(!load->decode[track]) return;
+
+	midi_parser parser;
+	midi_parser_init_track(&parser, track, chunk->length, append_event, part);
+	if(midi_parser_feed(&parser, load->data + chunk->offset, chunk->length) < 0 || midi_parser_finish(&parser) < 0) {
+		if(part->error_code == MIDI_OK) fail(part, parser.error_code);
+	}
+	midi_parser_free(&parser);
+}
+
+static void hash_track(void *ctx, int track) {
+	song_load *load = ctx;
+	const midi_track_chunk *chunk = &load->chunks[track];
+	load->song->tracks[track].hash = midi_hash(load->data + chunk->offset, chunk->length, MIDI_HASH_SEED);
+}
+
+// concatenates the per track parts into the song columns in track order
+static int merge_parts(midi_song *song, midi_song *parts) {
+	size_t events = 0, meta = 0, sysex = 0, pool = 0;
+	for(int t = 0; t < song->number_of_tracks; t++) {
+		events += parts[t].number_of_events;
+		meta += parts[t].number_of_meta;
+		sysex += parts[t].number_of_sysex;
+		pool += parts[t].payload_pool_size;
+	}
+	if(reserve_events(song, events > 0 ? events : 1) < 0) return -1;
+	if((song->meta = grow(NULL, &song->meta_capacity, meta > 0 ? meta : 1, sizeof(midi_song_payload))) == NULL) return -1;
+	if((song->sysex = grow(NULL, &song->sysex_capacity, sysex > 0 ? sysex : 1, sizeof(midi_song_payload))) == NULL) return -1;
+	if((song->payload_pool = grow(NULL, &song->payload_pool_capacity, pool > 0 ? pool : 1, 1)) == NULL) return -1;
+
+	for(int t = 0; t < song->number_of_tracks; t++) {
+		midi_song *part = &parts[t];
+		midi_song_track *track = &song->tracks[t];
+		size_t first = song->number_of_events;
+		track->first_event = first;
+		track->number_of_events = part->number_of_events;
+		track->first_meta = song->number_of_meta;
+		track->number_of_meta = part->number_of_meta;
+		track->first_sysex = song->number_of_sysex;
+		track->number_of_sysex = part->number_of_sysex;
+
+		size_t n = part->number_of_events;
+		if(n > 0) {
+			memcpy(song->tick + first, part->tick, n * sizeof(*song->tick));
+			memcpy(song->status + first, part->status, n);
+			memcpy(song->data1 + first, part->data1, n);
+			memcpy(song->data2 + first, part->data2, n);
+			for(size_t i = 0; i < n; i++) song->track[first + i] = t;
+		}
+		for(size_t i = 0; i < part->number_of_meta; i++) {
+			midi_song_payload *p = &song->meta[song->number_of_meta++];
+			*p = part->meta[i];
+			p->event += first;
+			p->offset += song->payload_pool_size;
+		}
+		for(size_t i = 0; i < part->number_of_sysex; i++) {
+			midi_song_payload *p = &song->sysex[song->number_of_sysex++];
+			*p = part->sysex[i];
+			p->event += first;
+			p->offset += song->payload_pool_size;
+		}
+		if(part->payload_pool_size > 0) {
+			memcpy(song->payload_pool + song->payload_pool_size, part->payload_pool, part->payload_pool_size);
+			song->payload_pool_size += part->payload_pool_size;
+		}
+		song->number_of_events += n;
+	}
+	return 0;
+}
+
+static int load_song(midi_song *song, const unsigned char *data, size_t size, midi_song_filter filter, void *user, int max_threads) {
+	midi_song_free(song);
+	midi_reader in = { .data = data, .size = size };
+
+	const unsigned char *file_header = midi_reader_bytes(&in, 4);
+	if(file_header == NULL || memcmp(file_header, FILE_HEADER, 4) != 0) return fail(song, MIDI_ERROR_NOT_MIDI);
+	if(!midi_reader_u32(&in, &song->header_size) ||
+		!midi_reader_u16(&in, &song->format) ||
+		!midi_reader_u16(&in, &song->number_of_tracks) ||
+		!midi_reader_u16(&in, &song->division)) {
+		return fail(song, MIDI_ERROR_END_OF_FILE);
+	}
+	if(song->header_size < 6) return fail(song, MIDI_ERROR_HEADER_TOO_SHORT);
+
+	// the chunk lengths tell where every track starts, so the tracks decode independently
+	int number_of_tracks = song->number_of_tracks;
+	in.pos = 8 + song->header_size;
+	midi_track_chunk *chunks = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(midi_track_chunk));
+	midi_song *parts = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(midi_song));
+	bool *decode = malloc((number_of_tracks > 0 ? number_of_tracks : 1) * sizeof(bool));
+	song->tracks = calloc(number_of_tracks > 0 ? number_of_tracks : 1, sizeof(midi_song_track));
+	if(chunks == NULL || parts == NULL || decode == NULL || song->tracks == NULL) {
+		free(chunks);
+		free(parts);
+		free(decode);
+		return fail(song, MIDI_ERROR_OUT_OF_MEMORY);
+	}
+
+	int result = 0;
+	if(midi_reader_find_tracks(&in, chunks, number_of_tracks) < number_of_tracks) {
+		result = fail(song, MIDI_ERROR_NO_TRACK);
+	} else {
+		song_load load = { .parts = parts, .data = data, .chunks = chunks, .decode = decode, .song = song };
+		for(int t = 0; t < number_of_tracks; t++) {
+			song->tracks[t].length = chunks[t].length;
+			decode[t] = true;
+		}
+		if(filter != NULL) {
+			midi_parallel_for(number_of_tracks, max_threads, hash_track, &load);
+			filter(user, song, decode);
+		}
+		midi_parallel_for(number_of_tracks, song->format == 0 ? 1 : max_threads, decode_track, &load);
+		for(int t = 0; t < number_of_tracks && result == 0; t++) {
+			if(parts[t].error_code != MIDI_OK) result = fail(song, parts[t].error_code);
+		}
+		if(result == 0 && merge_parts(song, parts) < 0) result = fail(song, MIDI_ERROR_OUT_OF_MEMORY);
+	}
+
+	for(int t = 0; t < number_of_tracks; t++) {
+		midi_song_free(&parts[t]);
+	}
+	free(parts);
+	free(chunks);
+	free(decode);
+	return result;
+}
+
+int midi_song_load_buffer(midi_song *song, const unsigned char *data, size_t size) {
+	return load_song(song, data, size, NULL, NULL, 0);
+}
+
+int midi_song_load_threads(midi_song *song, const unsigned char *data, size_t size, int max_threads) {
+	return load_song(song, data, size, NULL, NULL, max_threads);
+}
+
+int midi_song_load_filtered(midi_song *song, const unsigned char *data, size_t size, midi_song_filter filter, void *user) {
+	return load_song(song, data, size, filter, user, 0);
+}
+
+int midi_song_load_file(midi_song *song, const char *filename) {
+	midi_reader in;
+	if(midi_reader_open(&in, filename) < 0) {
+		midi_song_free(song);
+		return fail(song, MIDI_ERROR_FILE_NOT_FOUND);
+	}
+	int result = midi_song_load_buffer(song, in.data, in.size);
+	midi_reader_close(&in);
+	return result;
+}
@@ -0,0 +1,88 @@
+#ifndef MIDI_SONG_H
+#define MIDI_SONG_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "midi_parser.h"
+
+// A whole midi file decoded into columns. Every event (channel, meta and
+// sysex alike) is one row, rows are grouped by track in file order, and
+// each column is a separate contiguous array so passes over the song can
+// walk just the columns they need. Meta and sysex payloads live in side
+// tables that are sorted by row, like the rows themselves.
+
+typedef struct {
+	size_t event;    // row of the event
+	size_t offset;   // into payload_pool
+	size_t length;
+} midi_song_payload;
+
+typedef struct {
+	size_t first_event;
+	size_t number_of_events;
+	size_t first_meta;
+	size_t number_of_meta;
+	size_t first_sysex;
+	size_t number_of_sysex;
+	size_t length;   // MTrk chunk length in bytes
+	unsigned long long hash; // midi_hash of the chunk, only with midi_song_load_filtered
+} midi_song_track;
+
+typedef struct {
+	unsigned int header_size;
+	unsigned short format;
+	unsigned short number_of_tracks;
+	unsigned short division;
+
+	size_t number_of_events;
+	size_t event_capacity;
+	unsigned int *tick;      // absolute ticks since the track start
+	unsigned char *status;   // command byte, META_EVENT or SYSEX_EVENT
+	unsigned char *data1;    // first data byte, meta type for meta events
+	unsigned char *data2;    // second data byte, 0 if the event has none
+	unsigned short *track;
+
+	midi_song_track *tracks; // number_of_tracks entries
+
+	midi_song_payload *meta;
+	size_t number_of_meta;
+	size_t meta_capacity;
+	midi_song_payload *sysex;
+	size_t number_of_sysex;
+	size_t sysex_capacity;
+	unsigned char *payload_pool;
+	size_t payload_pool_size;
+	size_t payload_pool_capacity;
+
+	midi_error error_code;
+	const char *error;       // midi_error_string(error_code)
+} midi_song;
+
+void midi_song_init(midi_song *song);
+void midi_song_free(midi_song *song);
+
+// return 0 on success, -1 with song->error_code set
+int midi_song_load_file(midi_song *song, const char *filename);
+int midi_song_load_buffer(midi_song *song, const unsigned char *data, size_t size);
+// like midi_song_load_buffer, the tracks decoded on up to max_threads threads (0 one per cpu).
+// 1 for callers that already load one song per cpu
+int midi_song_load_threads(midi_song *song, const unsigned char *data, size_t size, int max_threads);
+
+// picks the tracks midi_song_load_filtered decodes. It is called once the
+// header and the length and hash of every track are known, with decode all
+// true; the tracks set to false are left without events
+typedef void (*midi_song_filter)(void *user, const midi_song *song, bool *decode);
+int midi_song_load_filtered(midi_song *song, const unsigned char *data, size_t size, midi_song_filter filter, void *user);
+
+// delta time of a row, relative to the previous row of the same track
+static inline unsigned int midi_song_delta(const midi_song *song, size_t event) {
+	const midi_song_track *t = &song->tracks[song->track[event]];
+	return event == t->first_event ? song->tick[event] : song->tick[event] - song->tick[event - 1];
+}
+
+static inline const unsigned char *midi_song_payload_data(const midi_song *song, const midi_song_payload *payload) {
+	return song->payload_pool + payload->offset;
+}
+
+#endif
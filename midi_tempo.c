@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "midi_common.h"
+#include "midi_tempo.h"
+
+void midi_tempo_map_init(midi_tempo_map *map, unsigned short division) {
+	memset(map, 0, sizeof(*map));
+	map->division = division;
+}
+
+void midi_tempo_map_free(midi_tempo_map *map) {
+	free(map->changes);
+	midi_tempo_map_init(map, map->division);
+}
+
+unsigned int midi_tempo_value(const unsigned char *payload, size_t length) {
+	if(length != 3) return 0;
+	return ((unsigned int)payload[0] << 16) | ((unsigned int)payload[1] << 8) | payload[2];
+}
+
+int midi_tempo_map_add(midi_tempo_map *map, unsigned int tick, unsigned int tempo) {
+	if(tempo == 0) return 0;
+	size_t cursor = 0;
+	if(map->number_of_changes > 0) {
+		midi_tempo_change *last = &map->changes[map->number_of_changes - 1];
+		if(tick <= last->tick) {
+			// a later change at the same tick wins
+			last->tempo = tempo;
+			return 0;
+		}
+		cursor = map->number_of_changes;
+	}
+	double ms = midi_tempo_ms(map, &cursor, tick);
+	if(map->number_of_changes == map->capacity) {
+		size_t capacity = map->capacity ? map->capacity * 2 : 64;
+		midi_tempo_change *grown = realloc(map->changes, capacity * sizeof(midi_tempo_change));
+		if(grown == NULL) return -1;
+		map->changes = grown;
+		map->capacity = capacity;
+	}
+	map->changes[map->number_of_changes++] = (midi_tempo_change){ .tick = tick, .tempo = tempo, .ms = ms };
+	return 0;
+}
+
+int midi_tempo_map_build(midi_tempo_map *map, const midi_song *song, int track) {
+	midi_tempo_map_init(map, song->division);
+	if(track < 0 || track >= song->number_of_tracks) return 0;
+	const midi_song_track *t = &song->tracks[track];
+	for(size_t m = t->first_meta; m < t->first_meta + t->number_of_meta; m++) {
+		const midi_song_payload *meta = &song->meta[m];
+		if(song->data1[meta->event] != SET_TEMPO) continue;
+		unsigned int tempo = midi_tempo_value(midi_song_payload_data(song, meta), meta->length);
+		if(midi_tempo_map_add(map, song->tick[meta->event], tempo) < 0) {
+			midi_tempo_map_free(map);
+			return -1;
+		}
+	}
+	return 0;
+}
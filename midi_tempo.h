@@ -0,0 +1,54 @@
+#ifndef MIDI_TEMPO_H
+#define MIDI_TEMPO_H
+
+#include <stddef.h>
+
+#include "midi_song.h"
+
+// Tempo map of a song: every "Set tempo" (0x51) meta event, sorted by tick,
+// each with the absolute time it takes effect. Events are converted to
+// milliseconds by walking the map with a cursor alongside the (sorted)
+// events of a track, one linear merge instead of a search per event.
+// Before the first change the tempo is 120 BPM, as the midi spec says.
+
+#define MIDI_TEMPO_DEFAULT 500000 // microseconds per quarter note
+
+typedef struct {
+	unsigned int tick;
+	unsigned int tempo;      // microseconds per quarter note
+	double ms;               // absolute time of tick
+} midi_tempo_change;
+
+typedef struct {
+	unsigned short division; // from the file header, SMPTE divisions ignore the tempo
+	midi_tempo_change *changes;
+	size_t number_of_changes;
+	size_t capacity;
+} midi_tempo_map;
+
+void midi_tempo_map_init(midi_tempo_map *map, unsigned short division);
+void midi_tempo_map_free(midi_tempo_map *map);
+// appends a change, changes must come in tick order. Returns -1 when out of memory
+int midi_tempo_map_add(midi_tempo_map *map, unsigned int tick, unsigned int tempo);
+// the tempo changes of one track: track 0 for format 0 and 1, each track on its own for format 2
+int midi_tempo_map_build(midi_tempo_map *map, const midi_song *song, int track);
+// tempo in a 0x51 payload, 0 if the payload is not 3 bytes
+unsigned int midi_tempo_value(const unsigned char *payload, size_t length);
+
+// absolute time of tick. cursor starts at 0 and must be passed back with
+// ticks that never go down, it then only ever moves forward through the map
+static inline double midi_tempo_ms(const midi_tempo_map *map, size_t *cursor, unsigned int tick) {
+	if(map->division & 0x8000) {
+		// SMPTE: frames per second (negative in the high byte) times ticks per frame
+		int frames = -(signed char)(map->division >> 8);
+		int ticks_per_frame = map->division & 0xFF;
+		return frames * ticks_per_frame > 0 ? tick * 1000.0 / (frames * ticks_per_frame) : 0;
+	}
+	if(map->division == 0) return 0;
+	while(*cursor < map->number_of_changes && map->changes[*cursor].tick <= tick) (*cursor)++;
+	if(*cursor == 0) return tick * (MIDI_TEMPO_DEFAULT / 1000.0) / map->division;
+	const midi_tempo_change *change = &map->changes[*cursor - 1];
+	return change->ms + (tick - change->tick) * (change->tempo / 1000.0) / map->division;
+}
+
+#endif
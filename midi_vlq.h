@@ -0,0 +1,34 @@
+#ifndef MIDI_VLQ_H
+#define MIDI_VLQ_H
+
+#include <stddef.h>
+
+// Variable length quantities as used for delta times and meta / sysex
+// lengths: 7 bits per byte, high bit set on every byte but the last, at
+// most 4 bytes. They are found one at a time: where the next one starts is
+// only known once the event before it is decoded (its status, running
+// status, data or payload length), so the ends of several quantities can't
+// be found in one pass over the window.
+
+#define MIDI_VLQ_MAX_BYTES 4
+
+// bytes taken by the quantity at p, or 0 if it does not end within the
+// first MIN(available, MIDI_VLQ_MAX_BYTES) bytes
+static inline int midi_vlq_length(const unsigned char *p, size_t available) {
+	size_t limit = available < MIDI_VLQ_MAX_BYTES ? available : MIDI_VLQ_MAX_BYTES;
+	for(size_t i = 0; i < limit; i++) {
+		if(p[i] < 0x80) return i + 1;
+	}
+	return 0;
+}
+
+// value of a quantity of the given length, as found by midi_vlq_length
+static inline unsigned int midi_vlq_value(const unsigned char *p, int length) {
+	unsigned int value = p[0] & 0x7F;
+	for(int i = 1; i < length; i++) {
+		value = (value << 7) | (p[i] & 0x7F);
+	}
+	return value;
+}
+
+#endif
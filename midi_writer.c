@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "midi_writer.h"
+
+const size_t WRITER_BUFFER_SIZE = 1 << 20;
+const size_t MEMORY_WRITER_SIZE = 64 * 1024;
+
+int midi_writer_init(midi_writer *w, int fd) {
+	memset(w, 0, sizeof(*w));
+	w->fd = fd;
+	w->capacity = fd >= 0 ? WRITER_BUFFER_SIZE : MEMORY_WRITER_SIZE;
+	w->data = malloc(w->capacity);
+	if(w->data == NULL) {
+		w->capacity = 0;
+		w->failed = true;
+		return -1;
+	}
+	return 0;
+}
+
+void midi_writer_free(midi_writer *w) {
+	free(w->data);
+	w->data = NULL;
+	w->len = 0;
+	w->capacity = 0;
+}
+
+// writes all of iov, retrying short writes
+static bool write_all(int fd, struct iovec *iov, int count) {
+	while(count > 0) {
+		ssize_t n = writev(fd, iov, count);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			return false;
+		}
+		while(count > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+	return true;
+}
+
+int midi_writer_flush(midi_writer *w) {
+	if(w->fd >= 0 && w->len > 0) {
+		struct iovec iov = { .iov_base = w->data, .iov_len = w->len };
+		if(!write_all(w->fd, &iov, 1)) w->failed = true;
+		w->len = 0;
+	}
+	return w->failed ? -1 : 0;
+}
+
+// makes room for n more bytes, by flushing or, in memory, by growing
+static bool reserve(midi_writer *w, size_t n) {
+	if(w->failed) return false;
+	if(w->capacity - w->len >= n) return true;
+	if(w->fd >= 0) {
+		midi_writer_flush(w);
+		return !w->failed && w->capacity >= n;
+	}
+	size_t capacity = w->capacity ? w->capacity : MEMORY_WRITER_SIZE;
+	while(capacity - w->len < n) capacity *= 2;
+	char *grown = realloc(w->data, capacity);
+	if(grown == NULL) {
+		w->failed = true;
+		return false;
+	}
+	w->data = grown;
+	w->capacity = capacity;
+	return true;
+}
+
+static void write_through(midi_writer *w, const char *s, size_t n) {
+	struct iovec iov[2] = {
+		{ .iov_base = w->data, .iov_len = w->len },
+		{ .iov_base = (void *)s, .iov_len = n }
+	};
+	if(!write_all(w->fd, iov, 2)) w->failed = true;
+	w->len = 0;
+}
+
+void midi_writer_bytes(midi_writer *w, const char *s, size_t n) {
+	if(w->fd >= 0 && n > w->capacity - w->len && n >= w->capacity / 2) {
+		// too big to be worth copying, goes out together with the buffer
+		if(!w->failed) write_through(w, s, n);
+		return;
+	}
+	if(!reserve(w, n)) return;
+	memcpy(w->data + w->len, s, n);
+	w->len += n;
+}
+
+void midi_writer_append(midi_writer *w, const midi_writer *other) {
+	if(other->failed) w->failed = true;
+	midi_writer_bytes(w, other->data, other->len);
+}
+
+// digits of value written backwards from end, returns the first digit
+static char *format_uint(char *end, unsigned long value) {
+	static const char pairs[201] =
+		"00010203040506070809101112131415161718192021222324"
+		"25262728293031323334353637383940414243444546474849"
+		"50515253545556575859606162636465666768697071727374"
+		"75767778798081828384858687888990919293949596979899";
+	char *p = end;
+	while(value >= 100) {
+		const char *pair = pairs + (value % 100) * 2;
+		value /= 100;
+		*--p = pair[1];
+		*--p = pair[0];
+	}
+	if(value >= 10) {
+		*--p = pairs[value * 2 + 1];
+		*--p = pairs[value * 2];
+	} else {
+		*--p = '0' + value;
+	}
+	return p;
+}
+
+void midi_writer_uint(midi_writer *w, unsigned long value) {
+	char buffer[24];
+	char *end = buffer + sizeof(buffer);
+	char *p = format_uint(end, value);
+	midi_writer_bytes(w, p, end - p);
+}
+
+void midi_writer_int(midi_writer *w, long value) {
+	if(value < 0) {
+		midi_writer_char(w, '-');
+		midi_writer_uint(w, 0UL - (unsigned long)value);
+	} else {
+		midi_writer_uint(w, value);
+	}
+}
+
+// value as fixed point with the given number of decimals, rounded half to
+// even like printf. Exact for every float: it has 24 significant bits, and
+// scaling by 10^decimals adds at most 21 more (5^9), well within a double.
+static void write_fixed(midi_writer *w, double value, int decimals) {
+	static const double scale[10] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+	char buffer[48];
+	char *end = buffer + sizeof(buffer);
+	char *p = end;
+
+	double integer_part = floor(value);
+	double scaled = (value - integer_part) * scale[decimals];
+	double digits = floor(scaled);
+	double rest = scaled - digits;
+	if(rest > 0.5 || (rest == 0.5 && fmod(digits, 2) != 0)) digits++;
+	unsigned long fraction = (unsigned long)digits;
+	unsigned long integer = (unsigned long)integer_part;
+	if(fraction >= (unsigned long)scale[decimals]) {
+		fraction -= (unsigned long)scale[decimals];
+		integer++;
+	}
+
+	if(decimals > 0) {
+		char *fraction_end = p;
+		p = format_uint(p, fraction);
+		while(fraction_end - p < decimals) *--p = '0';
+		*--p = '.';
+	}
+	p = format_uint(p, integer);
+	midi_writer_bytes(w, p, end - p);
+}
+
+void midi_writer_float(midi_writer *w, float value) {
+	double d = value;
+	if(isnan(d) || isinf(d) || fabs(d) >= 1e15) {
+		// out of range for the fixed point path
+		midi_writer_format(w, "%f", d);
+		return;
+	}
+	if(w->shortest_floats && d != 0 && fabs(d) < 1) {
+		// 9 decimals are not enough below 1, fall back to the slow search
+		char buffer[32];
+		for(int precision = 1; precision <= 9; precision++) {
+			snprintf(buffer, sizeof(buffer), "%.*g", precision, d);
+			if(strtof(buffer, NULL) == value) break;
+		}
+		midi_writer_string(w, buffer);
+		return;
+	}
+	if(signbit(d)) {
+		midi_writer_char(w, '-');
+		d = -d;
+	}
+	if(!w->shortest_floats) {
+		write_fixed(w, d, 6);
+		return;
+	}
+	// fewest decimals that read back as the same float
+	static const double scale[10] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+	int decimals = 0;
+	while(decimals < 9 && (float)(nearbyint(d * scale[decimals]) / scale[decimals]) != (float)d) decimals++;
+	write_fixed(w, d, decimals);
+}
+
+void midi_writer_fixed(midi_writer *w, double value, int decimals) {
+	if(isnan(value) || isinf(value) || fabs(value) >= 1e9 || decimals < 0 || decimals > 9) {
+		midi_writer_format(w, "%.*f", decimals, value);
+		return;
+	}
+	if(signbit(value)) {
+		midi_writer_char(w, '-');
+		value = -value;
+	}
+	write_fixed(w, value, decimals);
+}
+
+void midi_writer_format(midi_writer *w, const char *format, ...) {
+	char buffer[256];
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+	if(n < 0) return;
+	if((size_t)n < sizeof(buffer)) {
+		midi_writer_bytes(w, buffer, n);
+		return;
+	}
+	char *large = malloc(n + 1);
+	if(large == NULL) {
+		w->failed = true;
+		return;
+	}
+	va_start(args, format);
+	vsnprintf(large, n + 1, format, args);
+	va_end(args);
+	midi_writer_bytes(w, large, n);
+	free(large);
+}
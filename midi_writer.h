@@ -0,0 +1,51 @@
+#ifndef MIDI_WRITER_H
+#define MIDI_WRITER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Buffered output for the json front ends. Text and numbers are appended
+// to one large buffer with hand written formatting and go out in big
+// write / writev calls. A writer without a file descriptor (fd -1) only
+// collects in memory, e.g. one track that is written in parallel and
+// appended to the real output later.
+typedef struct {
+	int fd;
+	char *data;
+	size_t len;
+	size_t capacity;
+	bool shortest_floats; // false: printf("%f") compatible, true: shortest text that reads back the same float
+	bool failed;          // out of memory or a failed write, sticky
+} midi_writer;
+
+int midi_writer_init(midi_writer *w, int fd);
+void midi_writer_free(midi_writer *w);
+// writes everything buffered so far, returns -1 if anything failed since init
+int midi_writer_flush(midi_writer *w);
+
+void midi_writer_bytes(midi_writer *w, const char *s, size_t n);
+void midi_writer_uint(midi_writer *w, unsigned long value);
+void midi_writer_int(midi_writer *w, long value);
+void midi_writer_float(midi_writer *w, float value);
+// value with a fixed number of decimals, at most 9
+void midi_writer_fixed(midi_writer *w, double value, int decimals);
+// printf style, for the rare lines that are not worth taking apart
+void midi_writer_format(midi_writer *w, const char *format, ...) __attribute__((format(printf, 2, 3)));
+// appends what a memory writer collected, handing it straight to writev when w has a file
+void midi_writer_append(midi_writer *w, const midi_writer *other);
+
+// inline so the length of a literal is known at compile time
+static inline void midi_writer_string(midi_writer *w, const char *s) {
+	midi_writer_bytes(w, s, strlen(s));
+}
+
+static inline void midi_writer_char(midi_writer *w, char c) {
+	if(w->len < w->capacity) {
+		w->data[w->len++] = c;
+	} else {
+		midi_writer_bytes(w, &c, 1);
+	}
+}
+
+#endif
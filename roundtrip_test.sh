@@ -0,0 +1,66 @@
+#!/bin/sh
+# Round trip of the binary format, run by make check: for every fixture the
+# json midi2json writes must equal the json bin2json makes of its
+# --format=bin output, with and without --shortest-floats.
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+bin=$(pwd)
+
+# the bytes given in hex, to stdout
+bytes() {
+	for byte in "$@"; do
+		printf "\\$(printf %o "0x$byte")"
+	done
+}
+
+# midi FILE FORMAT DIVISION TRACK..., every track the hex bytes of its events
+midi() {
+	file=$1
+	format=$2
+	division=$3
+	shift 3
+	{
+		bytes 4D 54 68 64 00 00 00 06 00 "$format" 00 "$#" $(printf '%02X %02X' $((division >> 8)) $((division & 255)))
+		for track in "$@"; do
+			set -- $track
+			bytes 4D 54 72 6B 00 00 $(printf '%02X %02X' $(($# >> 8)) $(($# & 255))) "$@"
+		done
+	} > "$file"
+}
+
+# Note ONs and Note OFFs on running status
+midi "$dir/running.mid" 0 96 \
+	"00 90 3C 40 10 3E 50 10 40 60 30 80 3C 00 00 3E 00 00 40 00 00 FF 2F 00"
+
+# a sysex message and an F7 escape between the notes
+midi "$dir/sysex.mid" 0 96 \
+	"00 F0 05 7E 7F 09 01 F7 00 90 3C 40 10 F7 02 F3 01 10 80 3C 00 00 FF 2F 00"
+
+# a tempo track and two note tracks, with program, controller and pitch bend
+midi "$dir/tracks.mid" 1 480 \
+	"00 FF 03 04 54 65 73 74 00 FF 51 03 07 A1 20 00 FF 58 04 04 02 18 08 00 FF 2F 00" \
+	"00 C0 05 00 90 3C 40 83 60 80 3C 40 00 FF 2F 00" \
+	"00 B1 07 64 00 91 43 50 81 70 E1 00 40 00 81 43 00 00 FF 2F 00"
+
+# the tempo changes between the notes
+midi "$dir/tempo.mid" 0 96 \
+	"00 FF 51 03 07 A1 20 00 90 3C 40 60 FF 51 03 0F 42 40 00 80 3C 00 60 FF 51 03 03 D0 90 00 90 3E 40 60 80 3E 00 00 FF 2F 00"
+
+failed=0
+cd "$dir" || exit 1
+for song in running sysex tracks tempo; do
+	for floats in "" --shortest-floats; do
+		if "$bin/midi2json" $floats $song.mid a.json > log 2>&1 &&
+			"$bin/midi2json" $floats --format=bin $song.mid a.bin > log 2>&1 &&
+			"$bin/bin2json" $floats a.bin b.json > log 2>&1 &&
+			cmp a.json b.json; then
+			echo "ok   $song $floats"
+		else
+			echo "FAIL $song $floats"
+			cat log
+			failed=1
+		fi
+	done
+done
+exit $failed